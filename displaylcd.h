@@ -0,0 +1,129 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// This header is shared by the driver and the programs that use it. It defines the ioctl commands accepted by the device files
+// (/dev/displaylcd, /dev/displaylcd_cls, /dev/displaylcd_pos and /dev/displaylcd_log) and the structures passed to them.
+
+#ifndef DISPLAYLCD_H
+#define DISPLAYLCD_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// The display controller (HD44780) has 80 bytes of display memory, so no display has more than 80 characters.
+// A frame is the whole content of the display, row after row, and only the first rows * columns bytes are used.
+#define DISPLAYLCD_MAX_CELLS	80
+
+// DISPLAYLCD_IOC_COST
+// Given a candidate frame, tells what it would cost to show it, starting from what the display is showing right now.
+// The frame is not sent to the display.
+struct displaylcd_cost {
+	char frame[DISPLAYLCD_MAX_CELLS];	// Input: the candidate frame
+	__u32 commands;						// Output: number of commands (cursor positioning) needed
+	__u32 chars;						// Output: number of characters that must be written
+	__u32 cgram_writes;					// Output: number of bytes written to the character generator memory (custom characters). Always 0, the
+										// glyphs are written when DISPLAYLCD_IOC_CHARMAP loads them, the frames only use them
+	__u32 predicted_us;					// Output: expected bus time, in microseconds
+};
+
+// DISPLAYLCD_IOC_SHOW
+// Shows a whole frame in a single call. Only the characters that are different from what the display is showing are sent.
+// The device file must be opened for writing.
+struct displaylcd_frame {
+	char frame[DISPLAYLCD_MAX_CELLS];
+};
+
+// DISPLAYLCD_IOC_BATCH
+// Shows a frame on several displays in a single call. The displays share the data pins and each one has its own EN pin: display 0 is the
+// one of /dev/displaylcd and the others are given to the driver with the extra_en module parameter. The driver sends to all of them at the
+// same time (a byte goes to a display while the others execute theirs), and the displays that show the same thing and get the same frame
+// are written together, with one EN pulse. The device file must be opened for writing.
+#define DISPLAYLCD_MAX_DISPLAYS	8
+struct displaylcd_batch {
+	__u32 mask;				// Input: bit d is set to show frames[d] on display d
+	__u32 mirrored;			// Output: the displays that were written together with a previous one
+	char frames[DISPLAYLCD_MAX_DISPLAYS][DISPLAYLCD_MAX_CELLS];
+};
+
+// DISPLAYLCD_IOC_SCROLL
+// Moves the view of /dev/displaylcd_log through the lines written to it. The view stops at the newest line and at the oldest one kept
+// by the driver, so a big negative number goes back to the newest lines. The log file must be opened for writing (EBADF otherwise).
+struct displaylcd_scroll {
+	__s32 lines;		// Input: lines to go back (negative goes forward, to the newer lines)
+	__u32 offset;		// Output: how many lines back from the newest the view is now
+	__u32 count;		// Output: the number of lines in the log
+};
+
+// DISPLAYLCD_IOC_ANIMATE
+// Makes the driver animate a region of the display (cells cell to cell + width - 1 of the frame): it shows the frames one after the other,
+// every period_ms (at least 50), until the slot is given another animation or no frames. To blink a field, give it its text and spaces.
+// The first frame is shown at once. A region that stops animating keeps the frame it was showing. The device file must be opened for writing.
+#define DISPLAYLCD_MAX_ANIMS	4
+#define DISPLAYLCD_ANIM_FRAMES	4
+struct displaylcd_anim {
+	__u8 slot;			// Which of the DISPLAYLCD_MAX_ANIMS animations this is
+	__u8 cell;			// The first cell of the region, counted from 0, row after row
+	__u8 width;			// The cells of the region
+	__u8 nframes;		// Frames to cycle through, 0 stops the animation
+	__u32 period_ms;	// How long each frame is shown
+	char frames[DISPLAYLCD_ANIM_FRAMES][DISPLAYLCD_MAX_CELLS];	// Only the first width characters of each frame are used
+};
+
+// DISPLAYLCD_IOC_MODE
+// Sets the cursor, the display and the direction of the writes. With DISPLAYLCD_RTL the characters of a write go from right to left, like
+// right to left scripts are written (the frames of DISPLAYLCD_IOC_SHOW are still row after row, from the left). Flags that are not set are
+// turned off, so 0 is the mode of the display when the driver is loaded. The device file must be opened for writing.
+#define DISPLAYLCD_CURSOR	0x01	// Show the cursor (an underline below the next character)
+#define DISPLAYLCD_BLINK	0x02	// Blink the character at the cursor
+#define DISPLAYLCD_RTL		0x04	// Move the cursor to the left after each character
+#define DISPLAYLCD_OFF		0x08	// Turn the display off, it keeps its content and shows it again when turned on
+struct displaylcd_mode {
+	__u32 flags;
+};
+
+// DISPLAYLCD_IOC_CHARMAP
+// Loads a translation table, so the programs write UTF-8 text to /dev/displaylcd and the driver shows each character with the right code of
+// the display ROM (which changes from country to country) or with a custom character. Up to 8 custom characters (glyphs) can be loaded, the
+// glyph g is the code g (or g + 8, they are the same). The characters that are not in the table are shown as '?', and the ASCII ones are shown
+// as they are unless the table has them. A table without entries turns the translation off, and the bytes written are shown as they are.
+// The device file must be opened for writing.
+#define DISPLAYLCD_CHARMAP_MAX	256
+#define DISPLAYLCD_GLYPHS		8
+struct displaylcd_charmap_entry {
+	__u32 codepoint;		// The Unicode character
+	__u8 code;				// Its code in the display
+	__u8 pad[3];
+};
+struct displaylcd_charmap {
+	__u32 count;			// Entries used
+	__u32 glyphs;			// Bit g is set to load glyph[g]
+	struct displaylcd_charmap_entry entries[DISPLAYLCD_CHARMAP_MAX];
+	__u8 glyph[DISPLAYLCD_GLYPHS][8];	// 8 rows of 5 pixels each, the top row first and the leftmost pixel in bit 4
+};
+
+#define DISPLAYLCD_IOC_MAGIC	'L'
+#define DISPLAYLCD_IOC_COST		_IOWR(DISPLAYLCD_IOC_MAGIC, 1, struct displaylcd_cost)
+#define DISPLAYLCD_IOC_SHOW		_IOW(DISPLAYLCD_IOC_MAGIC, 2, struct displaylcd_frame)
+#define DISPLAYLCD_IOC_BATCH	_IOWR(DISPLAYLCD_IOC_MAGIC, 3, struct displaylcd_batch)
+#define DISPLAYLCD_IOC_SCROLL	_IOWR(DISPLAYLCD_IOC_MAGIC, 4, struct displaylcd_scroll)
+#define DISPLAYLCD_IOC_ANIMATE	_IOW(DISPLAYLCD_IOC_MAGIC, 5, struct displaylcd_anim)
+#define DISPLAYLCD_IOC_MODE		_IOW(DISPLAYLCD_IOC_MAGIC, 6, struct displaylcd_mode)
+#define DISPLAYLCD_IOC_CHARMAP	_IOW(DISPLAYLCD_IOC_MAGIC, 7, struct displaylcd_charmap)
+
+#endif
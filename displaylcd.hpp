@@ -0,0 +1,302 @@
+/*
+ *
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Header-only C++17 client for the displaylcd driver.
+//
+// A screen is declared as a geometry plus a list of fields. Rows and columns are counted from 1, like /dev/displaylcd_pos does,
+// and the position and width of every field is checked when the program is compiled:
+//
+//     using Lcd = displaylcd::Geometry<2, 16>;
+//     using Temp = displaylcd::Field<Lcd, 1, 1, 8>;		// Row 1, column 1, 8 characters
+//     using Hum = displaylcd::Field<Lcd, 2, 1, 8>;
+//     displaylcd::Screen<Lcd, Temp, Hum> screen;
+//
+//     screen.print<Temp>("T %5.1fC", 23.5);
+//     screen.set<Hum>(42);
+//     screen.submit(device);		// One ioctl, the driver sends only the characters that changed
+//
+// The frame lives inside the Screen object and formatting is done in stack buffers, nothing is allocated from the heap.
+
+#ifndef DISPLAYLCD_HPP
+#define DISPLAYLCD_HPP
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdarg>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "displaylcd.h"
+
+namespace displaylcd {
+
+// The size of the display
+template <unsigned Rows, unsigned Cols>
+struct Geometry {
+	static_assert(Rows >= 1 && Cols >= 1, "The display must have at least one row and one column");
+	static_assert(Rows * Cols <= DISPLAYLCD_MAX_CELLS, "The display controller has memory for 80 characters only");
+
+	static constexpr unsigned rows = Rows;
+	static constexpr unsigned cols = Cols;
+	static constexpr unsigned cells = Rows * Cols;
+};
+
+using Lcd16x2 = Geometry<2, 16>;
+
+// A region of the display where a value is shown. It must fit in its row
+template <class G, unsigned Row, unsigned Col, unsigned Width>
+struct Field {
+	static_assert(Row >= 1 && Row <= G::rows, "The field row is outside the display");
+	static_assert(Col >= 1 && Col <= G::cols, "The field column is outside the display");
+	static_assert(Width >= 1, "The field must have at least one character");
+	static_assert(Col - 1 + Width <= G::cols, "The field does not fit in its row");
+
+	using geometry = G;
+	static constexpr unsigned row = Row;
+	static constexpr unsigned col = Col;
+	static constexpr unsigned width = Width;
+	static constexpr unsigned offset = (Row - 1) * G::cols + (Col - 1);	// Where the field starts in the frame
+};
+
+namespace detail {
+
+template <class A, class B>
+constexpr bool overlap()
+{
+	return A::offset < B::offset + B::width && B::offset < A::offset + A::width;
+}
+
+// True when no two fields of the list share a character
+template <class... F>
+struct disjoint : std::true_type {};
+
+template <class First, class... Rest>
+struct disjoint<First, Rest...>
+	: std::bool_constant<(!overlap<First, Rest>() && ...) && disjoint<Rest...>::value> {};
+
+template <class F, class... List>
+constexpr bool contains = (std::is_same_v<F, List> || ...);
+
+}
+
+// The real device. Frames are shown with the DISPLAYLCD_IOC_SHOW ioctl, one call per update
+class Device {
+public:
+	explicit Device(const char * path = "/dev/displaylcd")
+		: fd_(::open(path, O_WRONLY | O_CLOEXEC))
+	{
+		if(fd_ < 0)
+			throw std::system_error(errno, std::generic_category(), path);
+	}
+
+	Device(const Device &) = delete;
+	Device & operator=(const Device &) = delete;
+
+	Device(Device && other) noexcept : fd_(other.fd_) { other.fd_ = -1; }
+
+	~Device()
+	{
+		if(fd_ >= 0)
+			::close(fd_);
+	}
+
+	// Shows a frame of n characters (row after row). Returns 0 or an errno value
+	int show(const char * frame, std::size_t n) noexcept
+	{
+		displaylcd_frame f;
+
+		if(n > sizeof(f.frame))
+			return EINVAL;
+		std::memset(f.frame, ' ', sizeof(f.frame));
+		std::memcpy(f.frame, frame, n);
+		return ::ioctl(fd_, DISPLAYLCD_IOC_SHOW, &f) < 0 ? errno : 0;
+	}
+
+	// Asks the driver what it would cost to show a frame. Returns 0 or an errno value
+	int cost(const char * frame, std::size_t n, displaylcd_cost & out) noexcept
+	{
+		if(n > sizeof(out.frame))
+			return EINVAL;
+		std::memset(&out, 0, sizeof(out));
+		std::memset(out.frame, ' ', sizeof(out.frame));
+		std::memcpy(out.frame, frame, n);
+		return ::ioctl(fd_, DISPLAYLCD_IOC_COST, &out) < 0 ? errno : 0;
+	}
+
+	// Shows frames[d] on display d, for every bit d of b.mask, in a single call (the other displays are given to the driver with extra_en).
+	// Returns 0 or an errno value, b.mirrored tells which displays were written together with another one
+	int batch(displaylcd_batch & b) noexcept
+	{
+		return ::ioctl(fd_, DISPLAYLCD_IOC_BATCH, &b) < 0 ? errno : 0;
+	}
+
+	// Sets the cursor, blink, display off and right to left flags (DISPLAYLCD_CURSOR...). Returns 0 or an errno value
+	int mode(std::uint32_t flags) noexcept
+	{
+		displaylcd_mode m = { flags };
+
+		return ::ioctl(fd_, DISPLAYLCD_IOC_MODE, &m) < 0 ? errno : 0;
+	}
+
+	// Loads a translation table, after it the text given to the driver is UTF-8. Returns 0 or an errno value
+	int charmap(const displaylcd_charmap & map) noexcept
+	{
+		return ::ioctl(fd_, DISPLAYLCD_IOC_CHARMAP, &map) < 0 ? errno : 0;
+	}
+
+	int fd() const noexcept { return fd_; }
+
+private:
+	int fd_;
+};
+
+// A device that only records the frames it receives, for unit tests of programs that use the display
+template <class G>
+class MockDevice {
+public:
+	using Frame = std::array<char, G::cells>;
+
+	MockDevice() { current_.fill(' '); }
+
+	int show(const char * frame, std::size_t n)
+	{
+		if(n != G::cells)
+			return EINVAL;
+		if(fail_)
+			return fail_;
+		std::memcpy(current_.data(), frame, n);
+		frames_.push_back(current_);
+		return 0;
+	}
+
+	// Makes the next calls to show fail with an errno value (0 makes them work again)
+	void fail(int error) noexcept { fail_ = error; }
+
+	const Frame & current() const noexcept { return current_; }
+	const std::vector<Frame> & frames() const noexcept { return frames_; }
+	std::size_t count() const noexcept { return frames_.size(); }
+
+	// A row of the current frame, counted from 1
+	std::string_view row(unsigned r) const noexcept
+	{
+		return std::string_view(current_.data() + (r - 1) * G::cols, G::cols);
+	}
+
+private:
+	Frame current_;
+	std::vector<Frame> frames_;
+	int fail_ = 0;
+};
+
+// The content of the display, built field by field and submitted at once
+template <class G, class... Fields>
+class Screen {
+	static_assert((std::is_same_v<typename Fields::geometry, G> && ...), "Every field must belong to the screen geometry");
+	static_assert(detail::disjoint<Fields...>::value, "Two fields of the screen overlap");
+
+public:
+	Screen() noexcept { frame_.fill(' '); }
+
+	// Writes fixed text (like a label) anywhere in the screen, truncated at the end of the row. Row and column are counted from 1
+	void text(unsigned row, unsigned col, std::string_view s) noexcept
+	{
+		if(row < 1 || row > G::rows || col < 1 || col > G::cols)
+			return;
+		std::size_t n = std::min<std::size_t>(s.size(), G::cols - (col - 1));
+		std::memcpy(&frame_[(row - 1) * G::cols + (col - 1)], s.data(), n);
+	}
+
+	// Sets a field with a string, truncated or padded with spaces to the field width
+	template <class F>
+	void set(std::string_view s) noexcept
+	{
+		static_assert(detail::contains<F, Fields...>, "The field is not part of this screen");
+		std::size_t n = std::min<std::size_t>(s.size(), F::width);
+		std::memcpy(&frame_[F::offset], s.data(), n);
+		std::memset(&frame_[F::offset + n], ' ', F::width - n);
+	}
+
+	// Sets a field with an integer, aligned to the right. If it does not fit, the field is filled with '*'
+	template <class F, class T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+	void set(T value) noexcept
+	{
+		static_assert(detail::contains<F, Fields...>, "The field is not part of this screen");
+		char buf[24];
+		auto r = std::to_chars(buf, buf + sizeof(buf), value);
+		std::size_t n = r.ptr - buf;
+
+		if(r.ec != std::errc() || n > F::width)
+		{
+			std::memset(&frame_[F::offset], '*', F::width);
+			return;
+		}
+		std::memset(&frame_[F::offset], ' ', F::width - n);
+		std::memcpy(&frame_[F::offset + F::width - n], buf, n);
+	}
+
+	// Sets a field with printf formatting, truncated or padded to the field width. The compiler checks the format against the
+	// arguments, like it does for printf (fmt is the argument 2, this is the first)
+	template <class F>
+	__attribute__((format(printf, 2, 3))) void print(const char * fmt, ...) noexcept
+	{
+		static_assert(detail::contains<F, Fields...>, "The field is not part of this screen");
+		char buf[F::width + 1];
+		std::va_list args;
+
+		va_start(args, fmt);
+		int n = std::vsnprintf(buf, sizeof(buf), fmt, args);
+		va_end(args);
+
+		set<F>(std::string_view(buf, n < 0 ? 0 : std::min<std::size_t>(n, F::width)));
+	}
+
+	// Sends the whole screen to the device in a single call. Returns 0 or an errno value (or whatever the device throws, like
+	// MockDevice when it runs out of memory)
+	template <class D>
+	int submit(D & device)
+	{
+		return device.show(frame_.data(), frame_.size());
+	}
+
+	std::string_view row(unsigned r) const noexcept
+	{
+		return std::string_view(frame_.data() + (r - 1) * G::cols, G::cols);
+	}
+
+	const std::array<char, G::cells> & frame() const noexcept { return frame_; }
+
+private:
+	std::array<char, G::cells> frame_;
+};
+
+}
+
+#endif
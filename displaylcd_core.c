@@ -0,0 +1,562 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "displaylcd_core.h"
+
+// In the kernel module the bus is always the GPIO pins, so the Makefile names the bus function and the core calls it directly. This saves an
+// indirect call (and its retpoline) for every byte. The KUnit tests and the tools don't define it, and the bus of the core is used
+#ifdef LCD_BUS_WRITE
+void LCD_BUS_WRITE(void *, unsigned char, int);
+#define lcd_write(lcd, byte, rs) LCD_BUS_WRITE((lcd)->priv, byte, rs)
+#else
+#define lcd_write(lcd, byte, rs) (lcd)->bus->write((lcd)->priv, byte, rs)
+#endif
+
+// Prepares the state of a display. The caller must clear the display (lcd_cls) before using it, so the shadow matches the display
+void lcd_core_init(struct lcd_core * lcd, const struct lcd_bus * bus, void * priv)
+{
+	lcd->bus = bus;
+	lcd->priv = priv;
+	memset(lcd->shadow, ' ', sizeof(lcd->shadow));
+	lcd->cursor = 0;
+	lcd->control = LCD_CONTROL | LCD_CONTROL_DISPLAY;	// As the display is initialized
+	lcd->entry = LCD_ENTRY | LCD_ENTRY_INC;
+	lcd->dirty = false;
+	lcd->rows = 0;		// There's no previous content to keep
+	lcd->cols = 0;
+	lcd_geometry(lcd, ROWS, COLS, NULL);
+}
+
+// Checks if a row fits in one of the two lines of the display memory (0x00 to 0x27 and 0x40 to 0x67)
+static bool lcd_row_fits(int offset, int cols)
+{
+	if(offset < 0x40)
+		return offset + cols <= 0x28;
+	return offset + cols <= 0x68;
+}
+
+// Changes the geometry of the display. When offsets is NULL, the rows start where the HD44780 displays usually put them (page 12, figure 6
+// of the datasheet): the first row at 0x00, the second at 0x40, and in 4 rows displays the third and fourth continue the first and second
+// lines of the memory. The content that fits in the new geometry is kept in the shadow, and the rest is blank.
+// Returns 0, or -1 if the geometry is not possible (too many characters, or rows outside the display memory or overlapping each other)
+int lcd_geometry(struct lcd_core * lcd, int rows, int cols, const unsigned char * offsets)
+{
+	unsigned char shadow[MAX_CELLS];
+	unsigned char def[MAX_ROWS];
+	int x;
+	int y;
+
+	if((rows < 1) || (rows > MAX_ROWS) || (cols < 1) || (rows * cols > MAX_CELLS))
+		return -1;
+
+	if(!offsets)
+	{
+		def[0] = 0x00;
+		def[1] = 0x40;
+		def[2] = cols;
+		def[3] = 0x40 + cols;
+		offsets = def;
+	}
+
+	for(x = 0; x < rows; x++)
+	{
+		if(!lcd_row_fits(offsets[x], cols))
+			return -1;
+		for(y = 0; y < x; y++)
+			if((offsets[x] < offsets[y] + cols) && (offsets[y] < offsets[x] + cols))
+				return -1;
+	}
+
+	memset(shadow, ' ', sizeof(shadow));
+	for(x = 0; (x < rows) && (x < lcd->rows); x++)
+		memcpy(&shadow[x * cols], &lcd->shadow[x * lcd->cols], cols < lcd->cols ? cols : lcd->cols);
+	if(memcmp(shadow, lcd->shadow, sizeof(shadow)))
+		lcd->dirty = true;
+	memcpy(lcd->shadow, shadow, sizeof(shadow));
+
+	lcd->rows = rows;
+	lcd->cols = cols;
+	memcpy(lcd->offsets, offsets, rows);
+
+	return 0;
+}
+
+// Returns the display memory address of a cell of the shadow (cells are counted from 0, row after row)
+unsigned char lcd_addr(const struct lcd_core * lcd, int cell)
+{
+	return lcd->offsets[cell / lcd->cols] + cell % lcd->cols;
+}
+
+// Returns the shadow cell of a display memory address, or -1 if the address is not visible
+int lcd_cell(const struct lcd_core * lcd, unsigned char addr)
+{
+	int x;
+
+	for(x = 0; x < lcd->rows; x++)
+		if((addr >= lcd->offsets[x]) && (addr < lcd->offsets[x] + lcd->cols))
+			return x * lcd->cols + addr - lcd->offsets[x];
+	return -1;
+}
+
+// Returns the address the display moves the cursor to after a character is written at addr.
+// Each line has 40 bytes of memory, the end of the first line continues on the second, and the end of the second on the first.
+unsigned char lcd_next(unsigned char addr)
+{
+	addr++;
+	if(addr == 0x28)
+		return 0x40;
+	if(addr == 0x68)
+		return 0x00;
+	return addr;
+}
+
+// Returns the address the display moves the cursor to after a character is written at addr, when it writes from right to left.
+// The start of each line continues at the end of the other
+unsigned char lcd_prev(unsigned char addr)
+{
+	if(addr == 0x00)
+		return 0x67;
+	if(addr == 0x40)
+		return 0x27;
+	return addr - 1;
+}
+
+// Returns the address the cursor moves to after a character is written at addr, in the current entry mode
+unsigned char lcd_step(const struct lcd_core * lcd, unsigned char addr)
+{
+	return lcd->entry & LCD_ENTRY_INC ? lcd_next(addr) : lcd_prev(addr);
+}
+
+// This function sends the Clear Display (code 0x01) to the display, which clears the entire display and put the cursor in the first position
+void lcd_cls(struct lcd_core * lcd)
+{
+	int x;
+
+	lcd_write(lcd, 0x01, 0);	// Sends the Clear Display command, the bus waits the 1.52ms the display needs to execute it
+
+	// The Clear Display also sets the entry mode to left to right (datasheet, page 24), so a display writing from right to left is told again
+	if(!(lcd->entry & LCD_ENTRY_INC))
+		lcd_write(lcd, lcd->entry, 0);
+
+	for(x = 0; x < lcd_cells(lcd); x++)
+	{
+		if(lcd->shadow[x] != ' ')
+			lcd->dirty = true;
+	}
+	memset(lcd->shadow, ' ', sizeof(lcd->shadow));	// The display is now showing only spaces
+	lcd->cursor = 0;
+}
+
+// This function position the cursor in the display, according to the table below (for the 16x2 display, other geometries follow the same idea):
+// ---------------------------------------------------------------------------------
+// |  1 |  2 |  3 |  4 |  5 |  6 |  7 |  8 |  9 | 10 | 11 | 12 | 13 | 14 | 15 | 16 |
+// ---------------------------------------------------------------------------------
+// | 17 | 18 | 19 | 20 | 21 | 22 | 23 | 24 | 25 | 26 | 27 | 28 | 29 | 30 | 31 | 32 |
+// ---------------------------------------------------------------------------------
+void lcd_pos(struct lcd_core * lcd, unsigned char pos)
+{
+	// The first position in the display memory is 0, but I decided that the first position is 1 because... because. So I decrement it.
+	// Positions outside the display are ignored
+	if((pos == 0) || (pos > lcd_cells(lcd)))
+		return;
+
+	// According to the HD44780 datasheet (page 12, figure 6), the rows don't follow each other in the display memory (in the 16x2 display, the
+	// first position on the second line is 0x40), so lcd_addr looks up where the row starts
+	lcd_goto(lcd, lcd_addr(lcd, pos - 1));
+}
+
+// This function moves the cursor to a display memory address. It is used by lcd_pos, and by the frame updates, which already know the address
+void lcd_goto(struct lcd_core * lcd, unsigned char addr)
+{
+	lcd->cursor = addr;	// Take note of the new cursor position, for the shadow
+
+	// The command to set the cursor position is 1AAA.AAAA where A is the position value (in binary). So, I set the most significant bit to make the command value
+	lcd_write(lcd, addr | 0x80, 0);
+}
+
+// This function sends a string of characters to the display. 
+// It is expected that no more than a row (16 characters) will be sent to the display in a single write, so the function have a counter to ensure that no more than that will be sent.
+// That way, if a lot of charaters is passed to this function, there is no chance of messing with the display contents.
+// The display hve a memory with 40 bytes per line. If the cursor is in the last position (like, position 16 of the first line) and 16 characters are set, they will be written to
+// the display memory, but won't be shown. There is no harm in doing this, the exceeding characters just will not be shown.
+void lcd_print(struct lcd_core * lcd, const unsigned char * buffer)
+{
+	int x;
+	
+	// It is expected that this loop never reaches the maximum, the value is just a guard
+	for(x = 0; x < lcd->cols; x++)
+	{
+		if(buffer[x] == 0)	// This means we reached the end of the string
+			return;
+			
+		lcd_char(lcd, buffer[x]);
+	}
+}
+
+// Updates the shadow with a character written in the cursor position, if it is visible, and moves the cursor like the display does
+static void lcd_shadow_char(struct lcd_core * lcd, unsigned char c)
+{
+	int cell;
+
+	cell = lcd_cell(lcd, lcd->cursor);
+	if((cell >= 0) && (lcd->shadow[cell] != c))
+	{
+		lcd->shadow[cell] = c;
+		lcd->dirty = true;
+	}
+	lcd->cursor = lcd_step(lcd, lcd->cursor);
+}
+
+// This function writes a character in the cursor position
+void lcd_char(struct lcd_core * lcd, unsigned char c)
+{
+	lcd_write(lcd, c, 1);
+	lcd_shadow_char(lcd, c);
+}
+
+// Changes the Display On/Off Control (display, cursor and blink) and the Entry Mode Set (the direction the cursor moves). Only the commands
+// that changed are sent. The display shift of the Entry Mode Set moves the whole display instead of the cursor, which the shadow can't follow,
+// so the caller must not set it
+void lcd_mode(struct lcd_core * lcd, unsigned char control, unsigned char entry)
+{
+	if(control != lcd->control)
+	{
+		lcd->control = control;
+		lcd_write(lcd, control, 0);
+	}
+	if(entry != lcd->entry)
+	{
+		lcd->entry = entry;
+		lcd_write(lcd, entry, 0);
+	}
+}
+
+// Parses the message written to /dev/displaylcd_pos. It returns the position to be passed to lcd_pos, or -1 if the message is not valid
+int lcd_parse_pos(const struct lcd_core * lcd, const char * buffer, size_t len)
+{
+	int pos = 0;
+
+	if(len == 0)	// If the user didn't sent any character, there is nothing I can do
+		return -1;
+
+	if(len == 1)	// If the user sent only 1 character, I will (try) to use it to calculate the value
+	{
+		if((buffer[0] >= '0') && (buffer[0] <= '9'))	// If the value passed is a number, I will use to calculate the position and execute the command, otherwise I will do nothing
+			return buffer[0] - '0';
+		return -1;
+	}
+
+	// If the message is bigger than 1 character, I will (try) to use the first two characters to calculate the position
+	if((buffer[0] >= '0') && (buffer[0] <= '9'))
+		pos = buffer[0] - '0';
+
+	if((buffer[1] >= '0') && (buffer[1] <= '9'))
+	{
+		pos = pos * 10;
+		pos = pos + buffer[1] - '0';
+	}
+
+	if((pos != 0) && (pos <= lcd_cells(lcd)))
+		return pos;
+
+	return -1;
+}
+
+// Executes the message written to one of the device files. The buffer must be in kernel memory (or, in userspace, in the program memory)
+void lcd_handle_write(struct lcd_core * lcd, int minor, const char * buffer, size_t len)
+{
+	unsigned char message[32];
+	int pos;
+
+	// opening (and writing) to /dev/displaylcd_cls gives a minor number of 1
+	if(minor == 1)
+	{
+		lcd_cls(lcd);
+		return;
+	}
+
+	// opening (and writing) to /dev/displaylcd_pos gives a minor number of 2
+	if(minor == 2)
+	{
+		pos = lcd_parse_pos(lcd, buffer, len);
+		if(pos >= 0)
+			lcd_pos(lcd, pos);
+		return;
+	}
+
+	// opening (and writing) to /dev/displaylcd gives a minor number of 0
+	if(minor == 0)
+	{
+		if(len >= sizeof(message))
+			len = sizeof(message) - 1;
+
+		// The echo -n do not put an end of string in the buffer, so I will copy the bytes to the message buffer,
+		// and put a \0 after it. If the program that is sending the characters puts the \0 on the string, another \0 will be inserted, which is redunctant but harmless
+		memcpy(message, buffer, len);
+		message[len] = 0;
+
+		lcd_print(lcd, message);
+	}
+}
+
+// Builds the plan to show frame, starting from the shadow. Unchanged cells are skipped, and a positioning command is only added
+// when the cursor is not already where the next changed character must be written.
+void lcd_plan(const struct lcd_core * lcd, const unsigned char * frame, struct lcd_plan * plan)
+{
+	unsigned char addr = lcd->cursor;
+	bool inc = lcd->entry & LCD_ENTRY_INC;
+	int x;
+	int y;
+
+	plan->commands = 0;
+	plan->chars = 0;
+	plan->count = 0;
+
+	// The cells are visited in the direction the cursor moves, so changed cells next to each other are sent without positioning commands
+	for(y = 0; y < lcd_cells(lcd); y++)
+	{
+		x = inc ? y : lcd_cells(lcd) - 1 - y;
+		if(frame[x] == lcd->shadow[x])
+			continue;
+
+		if(addr != lcd_addr(lcd, x))
+		{
+			addr = lcd_addr(lcd, x);
+			plan->ops[plan->count++] = addr | 0x80;		// The Set DDRAM Address command, see lcd_goto
+			plan->commands++;
+		}
+
+		plan->ops[plan->count++] = PLAN_CHAR | frame[x];
+		plan->chars++;
+		addr = lcd_step(lcd, addr);
+	}
+}
+
+// A 64 bits hash (FNV-1a) of the first n cells of a frame. The driver finds the plans of the transitions it saw before with it, so it must
+// cost much less than lcd_plan: one multiplication per cell, without looking at the shadow
+unsigned long long lcd_hash(const unsigned char * frame, int n)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	int x;
+
+	for(x = 0; x < n; x++)
+	{
+		hash ^= frame[x];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// Updates the shadow and the cursor as if the plan was sent, for the users of the core that send the plan themselves
+void lcd_apply(struct lcd_core * lcd, const struct lcd_plan * plan)
+{
+	unsigned int x;
+
+	for(x = 0; x < plan->count; x++)
+	{
+		if(plan->ops[x] & PLAN_CHAR)
+			lcd_shadow_char(lcd, plan->ops[x] & 0xFF);
+		else
+			lcd->cursor = plan->ops[x] & 0x7F;
+	}
+}
+
+// Sends the plan to the display. The shadow and the cursor are updated by lcd_goto and lcd_char
+void lcd_run(struct lcd_core * lcd, const struct lcd_plan * plan)
+{
+	unsigned int x;
+
+	for(x = 0; x < plan->count; x++)
+	{
+		if(plan->ops[x] & PLAN_CHAR)
+			lcd_char(lcd, plan->ops[x] & 0xFF);
+		else
+			lcd_goto(lcd, plan->ops[x] & 0x7F);
+	}
+}
+
+// Loads a custom character in one of the 8 CGRAM slots (HD44780 datasheet, page 19): 8 rows of 5 pixels, the top row first, with the pixels in
+// the 5 least significant bits. The display shows it for the codes slot and slot + 8. The shadow doesn't change, and the cursor goes back to
+// where it was. The CGRAM address moves like the cursor does, so writing from right to left the rows are sent from the bottom one
+void lcd_glyph(struct lcd_core * lcd, int slot, const unsigned char * rows)
+{
+	bool inc = lcd->entry & LCD_ENTRY_INC;
+	int x;
+
+	lcd_write(lcd, 0x40 | (slot & 7) << 3 | (inc ? 0 : 7), 0);	// The Set CGRAM Address command
+	for(x = 0; x < 8; x++)
+		lcd_write(lcd, rows[inc ? x : 7 - x] & 0x1F, 1);
+	lcd_write(lcd, 0x80 | lcd->cursor, 0);
+}
+
+// Makes a translation table ready for lcd_charmap_lookup, from the map->count entries filled by the caller. The codes 0 to 7 are changed
+// to 8 to 15, which show the same custom characters, because the strings written to the display end at 0.
+// Returns -1 if there are too many entries, or a codepoint is not valid or appears twice
+int lcd_charmap_build(struct lcd_charmap * map)
+{
+	struct lcd_charmap_entry e;
+	unsigned int x;
+	unsigned int y;
+
+	if(map->count > CHARMAP_MAX)
+		return -1;
+
+	// An insertion sort is enough, the tables are small and built only when they are loaded
+	for(x = 1; x < map->count; x++)
+	{
+		e = map->entries[x];
+		for(y = x; (y > 0) && (map->entries[y - 1].codepoint > e.codepoint); y--)
+			map->entries[y] = map->entries[y - 1];
+		map->entries[y] = e;
+	}
+
+	for(x = 0; x < map->count; x++)
+	{
+		if((map->entries[x].codepoint > 0x10FFFF) || (x && (map->entries[x].codepoint == map->entries[x - 1].codepoint)))
+			return -1;
+		if(map->entries[x].code < 8)
+			map->entries[x].code += 8;
+	}
+
+	// The ASCII characters are the same in every ROM, unless the table says otherwise
+	for(x = 0; x < 0x80; x++)
+		map->ascii[x] = x;
+	for(x = 0; (x < map->count) && (map->entries[x].codepoint < 0x80); x++)
+		map->ascii[map->entries[x].codepoint] = map->entries[x].code;
+
+	return 0;
+}
+
+// Returns the character code of a codepoint, or CHARMAP_FALLBACK if it is not in the table
+unsigned char lcd_charmap_lookup(const struct lcd_charmap * map, unsigned int codepoint)
+{
+	unsigned int lo = 0;
+	unsigned int hi = map->count;
+	unsigned int mid;
+
+	if(codepoint < 0x80)
+		return map->ascii[codepoint];
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if(map->entries[mid].codepoint < codepoint)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if((lo < map->count) && (map->entries[lo].codepoint == codepoint))
+		return map->entries[lo].code;
+	return CHARMAP_FALLBACK;
+}
+
+// Decodes len bytes of UTF-8 text and translates every character to its code. out must have room for len codes (a character is never
+// shorter than its code), and it can be the text itself. Broken sequences are shown as CHARMAP_FALLBACK. Returns the number of codes
+size_t lcd_translate(const struct lcd_charmap * map, const char * in, size_t len, unsigned char * out)
+{
+	const unsigned char * s = (const unsigned char *)in;
+	unsigned int codepoint;
+	size_t n = 0;
+	size_t x = 0;
+	int more;
+
+	while(x < len)
+	{
+		if(s[x] < 0x80)		// Most of the text is ASCII
+		{
+			out[n++] = map->ascii[s[x++]];
+			continue;
+		}
+
+		// The first byte tells how many continuation bytes (10xx.xxxx) follow
+		if((s[x] & 0xE0) == 0xC0)
+		{
+			codepoint = s[x] & 0x1F;
+			more = 1;
+		}
+		else if((s[x] & 0xF0) == 0xE0)
+		{
+			codepoint = s[x] & 0x0F;
+			more = 2;
+		}
+		else if((s[x] & 0xF8) == 0xF0)
+		{
+			codepoint = s[x] & 0x07;
+			more = 3;
+		}
+		else
+		{
+			out[n++] = CHARMAP_FALLBACK;
+			x++;
+			continue;
+		}
+
+		for(x++; more && (x < len) && ((s[x] & 0xC0) == 0x80); x++, more--)
+			codepoint = (codepoint << 6) | (s[x] & 0x3F);
+
+		out[n++] = more ? CHARMAP_FALLBACK : lcd_charmap_lookup(map, codepoint);
+	}
+
+	return n;
+}
+
+// Computes the pin states of every byte. bit[] has the bit used for each pin in the states, in the order RS, EN, DB4, DB5, DB6 and DB7,
+// so the same tables serve the GPIO pins of the driver and the different wirings of the I2C expander boards
+void lcd_encode_init(struct lcd_encoding * enc, const unsigned char * bit)
+{
+	unsigned char nibble[16];
+	int rs;
+	int b;
+	int x;
+
+	// The data pins of each nibble, DB4 is the least significant bit, like lcd_nibble does
+	for(x = 0; x < 16; x++)
+	{
+		nibble[x] = 0;
+		for(b = 0; b < 4; b++)
+			if(x & (1 << b))
+				nibble[x] |= bit[2 + b];
+	}
+
+	for(rs = 0; rs < 2; rs++)
+	{
+		for(x = 0; x < 256; x++)
+		{
+			unsigned char * seq = enc->seq[rs][x];
+			unsigned char r = rs ? bit[0] : 0;
+
+			seq[0] = r | bit[1] | nibble[x >> 4];	// The most significant nibble first (HD44780 datasheet, page 22), with EN high...
+			seq[1] = r | nibble[x >> 4];			// ...and EN low makes the display take it, the data is kept for the hold time
+			seq[2] = r | bit[1] | nibble[x & 0x0F];
+			seq[3] = r | nibble[x & 0x0F];
+		}
+	}
+}
+
+// Copies the pin states of n bytes to out, which must have room for ENC_STATES states per byte. Returns the number of states copied
+unsigned int lcd_encode(const struct lcd_encoding * enc, int rs, const unsigned char * bytes, unsigned int n, unsigned char * out)
+{
+	unsigned int x;
+
+	for(x = 0; x < n; x++)
+		memcpy(&out[x * ENC_STATES], enc->seq[rs ? 1 : 0][bytes[x]], ENC_STATES);
+
+	return n * ENC_STATES;
+}
@@ -0,0 +1,153 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// The hardware independent part of the driver: the shadow of the display content, the cursor positioning, the string printing,
+// the parsing of the messages written to the device files and the planning of frame updates.
+// This file is compiled in the kernel module and also as a userspace library (see the tools directory), where the bus is a recording
+// backend instead of the GPIO pins. This way, the logic can be tested and measured without a Raspberry Pi.
+
+#ifndef DISPLAYLCD_CORE_H
+#define DISPLAYLCD_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#endif
+
+// The default display geometry, the 16x2 display of the original circuit. It can be changed with lcd_geometry
+#define COLS 16
+#define ROWS 2
+#define CELLS (COLS * ROWS)
+
+// The biggest geometry: the controller has memory for 80 characters, shown in up to 4 rows
+#define MAX_ROWS 4
+#define MAX_CELLS 80
+
+// When nothing was measured yet, a byte is expected to take the 40us delay of lcd_byte plus 11 GPIO changes (around 0.5us each on a Raspberry Pi 3)
+#define BYTE_NS 45500
+// The Clear Display and Return Home commands need 1.52ms, the driver waits 2ms after them
+#define CLEAR_NS 2000000
+
+// A plan is the list of bytes that must be sent to the display to change it from the shadow to a new frame.
+// Each op is a byte to be sent; PLAN_CHAR is set when it is a character (RS high) and clear when it is a command.
+#define PLAN_MAX (2 * MAX_CELLS)	// The worst case is a positioning command before every character
+#define PLAN_CHAR 0x100
+struct lcd_plan {
+	unsigned int commands;			// How many ops are commands
+	unsigned int chars;				// How many ops are characters
+	unsigned int count;				// Number of ops
+	unsigned short ops[PLAN_MAX];
+};
+
+// For backends that change all the pins at once (several GPIOs in one call, or the port of an I2C expander), every byte is a fixed sequence
+// of pin states: the high nibble with EN high, EN low, the low nibble with EN high, and EN low again. The sequences of the 256 bytes, for
+// both levels of RS, are computed once by lcd_encode_init, so sending a run of bytes becomes copying their states.
+#define ENC_STATES 4
+#define ENC_PINS 6		// RS, EN, DB4, DB5, DB6 and DB7, in this order
+struct lcd_encoding {
+	unsigned char seq[2][256][ENC_STATES];	// By RS level and byte, each state has a bit set for every pin that is high
+};
+
+// The Display On/Off Control and Entry Mode Set commands (HD44780 datasheet, page 24), with their bits. The display is initialized
+// on, without cursor and writing from left to right (the cursor moves to the right after each character)
+#define LCD_CONTROL 0x08
+#define LCD_CONTROL_DISPLAY 0x04	// The display is on
+#define LCD_CONTROL_CURSOR 0x02		// The cursor (an underline) is shown
+#define LCD_CONTROL_BLINK 0x01		// The character at the cursor blinks
+#define LCD_ENTRY 0x04
+#define LCD_ENTRY_INC 0x02			// The cursor moves to the right (when clear, to the left: right to left scripts)
+
+// A translation table, from Unicode codepoints to the character codes of the display: the ones of its ROM (which change from country to
+// country), or the custom characters loaded with lcd_glyph. The codepoints below 0x80 are looked up directly in ascii, the others with a
+// binary search in the entries, sorted by lcd_charmap_build. A codepoint that is not in the table is shown as CHARMAP_FALLBACK
+#define CHARMAP_MAX 256
+#define CHARMAP_FALLBACK '?'
+struct lcd_charmap_entry {
+	unsigned int codepoint;
+	unsigned char code;
+};
+struct lcd_charmap {
+	unsigned char ascii[0x80];
+	unsigned int count;
+	struct lcd_charmap_entry entries[CHARMAP_MAX];
+};
+
+// The bus is how the core talks to the display. In the kernel it is the GPIO pins, in userspace it is the recording backend.
+struct lcd_bus {
+	// Sends a byte to the display. rs is 1 for a character and 0 for a command. The function must also wait the time the display
+	// needs to execute it (2ms for the Clear Display and Return Home commands, 40us for anything else)
+	void (*write)(void * priv, unsigned char byte, int rs);
+};
+
+// The state of one display
+struct lcd_core {
+	const struct lcd_bus * bus;
+	void * priv;					// Passed to the bus functions
+	unsigned char rows;
+	unsigned char cols;
+	unsigned char offsets[MAX_ROWS];	// The display memory address where each row starts
+	unsigned char shadow[MAX_CELLS];	// What the display is showing right now, row after row (rows * cols characters)
+	unsigned char cursor;			// The display memory address where the next character will be written
+	unsigned char control;			// The last Display On/Off Control command sent
+	unsigned char entry;			// The last Entry Mode Set command sent, tells where the cursor moves after a character
+	bool dirty;						// Set when a character of the shadow changes, the user of the core clears it
+};
+
+void lcd_core_init(struct lcd_core *, const struct lcd_bus *, void *);	// Prepares the state, the display content is assumed to be blank
+int lcd_geometry(struct lcd_core *, int, int, const unsigned char *);	// Changes the number of rows and columns (and the row addresses, if not NULL)
+void lcd_cls(struct lcd_core *);					// Clear the LCD screen and position the cursor in the first position
+void lcd_pos(struct lcd_core *, unsigned char);		// Position the cursor in the display, starting from 1 (first position in the first line) to rows * cols (last position in the last line)
+void lcd_goto(struct lcd_core *, unsigned char);	// Moves the cursor to a display memory address (0x00 to 0x27 in the first memory line, 0x40 to 0x67 in the second)
+void lcd_char(struct lcd_core *, unsigned char);	// Writes a character in the cursor position, keeping the shadow up to date
+void lcd_print(struct lcd_core *, const unsigned char *);	// Prints a string in the display, calling lcd_char for every character in the array
+void lcd_mode(struct lcd_core *, unsigned char, unsigned char);	// Sends the Display On/Off Control and Entry Mode Set commands that changed
+void lcd_glyph(struct lcd_core *, int, const unsigned char *);	// Loads a custom character (8 rows of 5 pixels) in a CGRAM slot
+
+// The number of characters of the display
+static inline int lcd_cells(const struct lcd_core * lcd)
+{
+	return lcd->rows * lcd->cols;
+}
+
+unsigned char lcd_addr(const struct lcd_core *, int);	// The display memory address of a shadow cell
+int lcd_cell(const struct lcd_core *, unsigned char);	// The shadow cell of a display memory address, or -1 if it is not visible
+unsigned char lcd_next(unsigned char);					// The address the cursor moves to after a character is written (left to right)
+unsigned char lcd_prev(unsigned char);					// The same, writing from right to left
+unsigned char lcd_step(const struct lcd_core *, unsigned char);	// The same, in the entry mode of the display
+
+int lcd_parse_pos(const struct lcd_core *, const char *, size_t);	// Parses a message written to /dev/displaylcd_pos, returns the position or -1
+void lcd_handle_write(struct lcd_core *, int, const char *, size_t);	// Executes a message written to one of the device files (by minor number)
+
+void lcd_plan(const struct lcd_core *, const unsigned char *, struct lcd_plan *);	// Builds the plan to show a frame
+void lcd_run(struct lcd_core *, const struct lcd_plan *);							// Sends a plan to the display
+void lcd_apply(struct lcd_core *, const struct lcd_plan *);							// Updates the shadow as if a plan was sent
+unsigned long long lcd_hash(const unsigned char *, int);							// Hashes the cells of a frame, for the plan cache of the driver
+
+void lcd_encode_init(struct lcd_encoding *, const unsigned char *);		// Computes the pin states, given the bit of each pin (ENC_PINS of them)
+unsigned int lcd_encode(const struct lcd_encoding *, int, const unsigned char *, unsigned int, unsigned char *);	// Copies the states of a run of bytes
+
+int lcd_charmap_build(struct lcd_charmap *);			// Sorts and checks the entries filled by the caller, returns 0 or -1 if they are not valid
+unsigned char lcd_charmap_lookup(const struct lcd_charmap *, unsigned int);	// The character code of a codepoint
+size_t lcd_translate(const struct lcd_charmap *, const char *, size_t, unsigned char *);	// Decodes UTF-8 text into character codes, returns how many
+
+#endif
@@ -0,0 +1,444 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// KUnit tests of the driver core (displaylcd_core.c), using a mock bus that records every byte instead of moving the GPIO pins.
+// The tests check the exact bytes sent for writes, positioning, clear and wrapping, and the last case times the frame planner
+// on synthetic workloads, printing the cost per frame in the test log.
+//
+// Out of the kernel tree, build it with: make CONFIG_DISPLAYLCD_KUNIT_TEST=m (the kernel must have CONFIG_KUNIT)
+// To run it under UML, link this directory in the kernel tree (for example drivers/auxdisplay/displaylcd), source its Kconfig, and run
+//     ./tools/testing/kunit/kunit.py run --kunitconfig=drivers/auxdisplay/displaylcd
+
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+
+// The core is compiled in the test module, so the tests don't depend on the GPIO driver
+#include "displaylcd_core.c"
+
+#define MOCK_LOG 512
+
+struct mock_bus {
+	unsigned short ops[MOCK_LOG];	// Every byte received, with PLAN_CHAR set for characters
+	unsigned int count;
+};
+
+struct mock_test {
+	struct lcd_core lcd;
+	struct mock_bus bus;
+};
+
+static void mock_write(void * priv, unsigned char byte, int rs)
+{
+	struct mock_bus * bus = priv;
+
+	if(bus->count < MOCK_LOG)
+		bus->ops[bus->count++] = rs ? PLAN_CHAR | byte : byte;
+}
+
+static const struct lcd_bus mock = {
+	.write = mock_write
+};
+
+static int mock_init(struct kunit * test)
+{
+	struct mock_test * t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_NULL(test, t);
+	lcd_core_init(&t->lcd, &mock, &t->bus);
+	test->priv = t;
+
+	return 0;
+}
+
+// Checks the bytes received by the mock bus, and clears it for the next step of the test
+static void expect_ops(struct kunit * test, const unsigned short * ops, unsigned int count)
+{
+	struct mock_test * t = test->priv;
+	unsigned int x;
+
+	KUNIT_EXPECT_EQ(test, t->bus.count, count);
+	for(x = 0; x < min(count, t->bus.count); x++)
+		KUNIT_EXPECT_EQ_MSG(test, t->bus.ops[x], ops[x], "op %u", x);
+
+	t->bus.count = 0;
+}
+
+static void expect_row(struct kunit * test, int row, const char * text)
+{
+	struct mock_test * t = test->priv;
+
+	KUNIT_EXPECT_EQ(test, memcmp(&t->lcd.shadow[row * COLS], text, COLS), 0);
+}
+
+static void test_cls(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+	static const unsigned short ops[] = { 0x01 };
+
+	lcd_handle_write(&t->lcd, 0, "abc", 3);
+	t->bus.count = 0;
+	t->lcd.dirty = false;
+
+	lcd_handle_write(&t->lcd, 1, "x", 1);
+	expect_ops(test, ops, ARRAY_SIZE(ops));
+	expect_row(test, 0, "                ");
+	KUNIT_EXPECT_EQ(test, t->lcd.cursor, 0);
+	KUNIT_EXPECT_TRUE(test, t->lcd.dirty);
+}
+
+static void test_pos(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+	static const unsigned short first[] = { 0x80 };
+	static const unsigned short fifth[] = { 0x84 };
+	static const unsigned short second_line[] = { 0xC0 };
+	static const unsigned short last[] = { 0xCF };
+
+	lcd_handle_write(&t->lcd, 2, "1", 1);
+	expect_ops(test, first, ARRAY_SIZE(first));
+
+	lcd_handle_write(&t->lcd, 2, "5", 1);
+	expect_ops(test, fifth, ARRAY_SIZE(fifth));
+
+	lcd_handle_write(&t->lcd, 2, "17\n", 3);	// echo without -n adds a new line, only the first two characters matter
+	expect_ops(test, second_line, ARRAY_SIZE(second_line));
+	KUNIT_EXPECT_EQ(test, t->lcd.cursor, 0x40);
+
+	lcd_handle_write(&t->lcd, 2, "32", 2);
+	expect_ops(test, last, ARRAY_SIZE(last));
+
+	// Invalid positions are ignored
+	lcd_handle_write(&t->lcd, 2, "33", 2);
+	lcd_handle_write(&t->lcd, 2, "00", 2);
+	lcd_handle_write(&t->lcd, 2, "x", 1);
+	lcd_handle_write(&t->lcd, 2, "", 0);
+	expect_ops(test, NULL, 0);
+}
+
+static void test_write(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+	static const unsigned short hi[] = { PLAN_CHAR | 'H', PLAN_CHAR | 'i' };
+
+	lcd_handle_write(&t->lcd, 0, "Hi", 2);
+	expect_ops(test, hi, ARRAY_SIZE(hi));
+	expect_row(test, 0, "Hi              ");
+	KUNIT_EXPECT_EQ(test, t->lcd.cursor, 2);
+	KUNIT_EXPECT_TRUE(test, t->lcd.dirty);
+
+	// Writing the same characters again sends them, but the shadow doesn't change
+	t->lcd.dirty = false;
+	lcd_handle_write(&t->lcd, 2, "1", 1);
+	lcd_handle_write(&t->lcd, 0, "Hi", 2);
+	KUNIT_EXPECT_FALSE(test, t->lcd.dirty);
+}
+
+static void test_write_limit(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+
+	// No more than 16 characters are sent in a single write
+	lcd_handle_write(&t->lcd, 0, "0123456789abcdefXYZ", 19);
+	KUNIT_EXPECT_EQ(test, t->bus.count, 16);
+	expect_row(test, 0, "0123456789abcdef");
+	expect_row(test, 1, "                ");
+}
+
+static void test_wrap(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+
+	// From the last position of the first line, the characters go to the invisible part of the line memory
+	lcd_handle_write(&t->lcd, 2, "16", 2);
+	lcd_handle_write(&t->lcd, 0, "ABCD", 4);
+	expect_row(test, 0, "               A");
+	expect_row(test, 1, "                ");
+	KUNIT_EXPECT_EQ(test, t->lcd.cursor, 0x13);
+
+	// The end of the first line memory (0x27) continues at the start of the second line
+	lcd_goto(&t->lcd, 0x26);
+	lcd_handle_write(&t->lcd, 0, "xyz", 3);
+	expect_row(test, 1, "z               ");
+	KUNIT_EXPECT_EQ(test, t->lcd.cursor, 0x41);
+
+	// And the end of the second line continues at the start of the first
+	lcd_goto(&t->lcd, 0x67);
+	lcd_handle_write(&t->lcd, 0, "12", 2);
+	expect_row(test, 0, "2              A");
+}
+
+static void test_plan(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+	unsigned char frame[CELLS];
+	struct lcd_plan plan;
+	static const unsigned short run[] = { 0x83, PLAN_CHAR | 'a', PLAN_CHAR | 'b', 0xC0, PLAN_CHAR | 'c' };
+	static const unsigned short next[] = { PLAN_CHAR | 'd' };
+
+	memset(frame, ' ', CELLS);
+
+	// Nothing changed, nothing to send
+	lcd_plan(&t->lcd, frame, &plan);
+	KUNIT_EXPECT_EQ(test, plan.count, 0);
+
+	// Two runs of changed cells, each needs one positioning command
+	frame[3] = 'a';
+	frame[4] = 'b';
+	frame[COLS] = 'c';
+	lcd_plan(&t->lcd, frame, &plan);
+	KUNIT_EXPECT_EQ(test, plan.commands, 2);
+	KUNIT_EXPECT_EQ(test, plan.chars, 3);
+	lcd_run(&t->lcd, &plan);
+	expect_ops(test, run, ARRAY_SIZE(run));
+	KUNIT_EXPECT_EQ(test, memcmp(t->lcd.shadow, frame, CELLS), 0);
+
+	// The cursor is already after 'c', no positioning command is needed
+	frame[COLS + 1] = 'd';
+	lcd_plan(&t->lcd, frame, &plan);
+	lcd_run(&t->lcd, &plan);
+	expect_ops(test, next, ARRAY_SIZE(next));
+}
+
+static void test_rtl(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+	unsigned char frame[CELLS];
+	struct lcd_plan plan;
+	static const unsigned short mode[] = { LCD_CONTROL | LCD_CONTROL_DISPLAY | LCD_CONTROL_CURSOR, LCD_ENTRY };
+	static const unsigned short run[] = { 0x84, PLAN_CHAR | 'b', PLAN_CHAR | 'a' };
+	static const unsigned short cls[] = { 0x01, LCD_ENTRY };
+
+	// Only the commands that changed are sent
+	lcd_mode(&t->lcd, LCD_CONTROL | LCD_CONTROL_DISPLAY | LCD_CONTROL_CURSOR, LCD_ENTRY);
+	lcd_mode(&t->lcd, LCD_CONTROL | LCD_CONTROL_DISPLAY | LCD_CONTROL_CURSOR, LCD_ENTRY);
+	expect_ops(test, mode, ARRAY_SIZE(mode));
+
+	// Writing from right to left, the run is planned from its last cell, with a single positioning command
+	memset(frame, ' ', CELLS);
+	frame[3] = 'a';
+	frame[4] = 'b';
+	lcd_plan(&t->lcd, frame, &plan);
+	KUNIT_EXPECT_EQ(test, plan.commands, 1);
+	lcd_run(&t->lcd, &plan);
+	expect_ops(test, run, ARRAY_SIZE(run));
+	expect_row(test, 0, "   ab           ");
+	KUNIT_EXPECT_EQ(test, t->lcd.cursor, 0x02);
+
+	// The start of the second line continues at the end of the first
+	lcd_goto(&t->lcd, 0x40);
+	lcd_handle_write(&t->lcd, 0, "xy", 2);
+	expect_row(test, 1, "x               ");
+	KUNIT_EXPECT_EQ(test, t->lcd.cursor, 0x26);
+	t->bus.count = 0;
+
+	// The Clear Display goes back to left to right, so the entry mode is sent again
+	lcd_cls(&t->lcd);
+	expect_ops(test, cls, ARRAY_SIZE(cls));
+}
+
+static void test_charmap(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+	struct lcd_charmap * map = kunit_kzalloc(test, sizeof(*map), GFP_KERNEL);
+	static const unsigned char arrow[8] = { 0x04, 0x0E, 0x15, 0x04, 0x04, 0x04, 0x04, 0x00 };
+	static const unsigned short glyph[] = { 0x48, PLAN_CHAR | 0x04, PLAN_CHAR | 0x0E, PLAN_CHAR | 0x15, PLAN_CHAR | 0x04,
+		PLAN_CHAR | 0x04, PLAN_CHAR | 0x04, PLAN_CHAR | 0x04, PLAN_CHAR | 0x00, 0x80 };
+	const char text[] = "25\xc2\xb0" "C \xe2\x86\x91 \xe2\x82\xac\xc2";	// 25°C ↑ € and a broken sequence
+	unsigned char out[sizeof(text)];
+	size_t n;
+
+	KUNIT_ASSERT_NOT_NULL(test, map);
+
+	// The entries are given in any order, the glyph 1 becomes 9 so it is not the end of a string
+	map->count = 3;
+	map->entries[0].codepoint = 0x2191;		// ↑
+	map->entries[0].code = 1;
+	map->entries[1].codepoint = 0xB0;		// °, in the ROM of the A00 displays
+	map->entries[1].code = 0xDF;
+	map->entries[2].codepoint = 'C';
+	map->entries[2].code = 'c';
+	KUNIT_ASSERT_EQ(test, lcd_charmap_build(map), 0);
+	KUNIT_EXPECT_EQ(test, lcd_charmap_lookup(map, 0x2191), 9);
+	KUNIT_EXPECT_EQ(test, lcd_charmap_lookup(map, 'A'), 'A');
+	KUNIT_EXPECT_EQ(test, lcd_charmap_lookup(map, 0x20AC), CHARMAP_FALLBACK);
+
+	n = lcd_translate(map, text, sizeof(text) - 1, out);
+	KUNIT_EXPECT_EQ(test, n, 9);
+	KUNIT_EXPECT_EQ(test, memcmp(out, "25\xdf" "c \x09 ??", n), 0);
+
+	// A codepoint can't be there twice
+	map->count = 2;
+	map->entries[1].codepoint = 'C';
+	KUNIT_EXPECT_EQ(test, lcd_charmap_build(map), -1);
+
+	// The glyph goes to the CGRAM, and the cursor goes back to the display memory
+	lcd_glyph(&t->lcd, 1, arrow);
+	expect_ops(test, glyph, ARRAY_SIZE(glyph));
+}
+
+static void test_geometry(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+	static const unsigned char overlap[] = { 0x00, 0x10 };
+	static const unsigned short third_row[] = { 0x94 };
+	static const unsigned short last[] = { 0xE7 };
+
+	lcd_handle_write(&t->lcd, 0, "keep", 4);
+	t->bus.count = 0;
+
+	// Invalid geometries don't change anything
+	KUNIT_EXPECT_EQ(test, lcd_geometry(&t->lcd, 5, 16, NULL), -1);
+	KUNIT_EXPECT_EQ(test, lcd_geometry(&t->lcd, 4, 21, NULL), -1);
+	KUNIT_EXPECT_EQ(test, lcd_geometry(&t->lcd, 2, 20, overlap), -1);
+	KUNIT_EXPECT_EQ(test, t->lcd.rows, 2);
+	KUNIT_EXPECT_EQ(test, t->lcd.cols, 16);
+
+	// A 20x4 display: the third and fourth rows continue the first and second lines of the display memory
+	KUNIT_EXPECT_EQ(test, lcd_geometry(&t->lcd, 4, 20, NULL), 0);
+	KUNIT_EXPECT_EQ(test, memcmp(t->lcd.shadow, "keep                ", 20), 0);
+
+	lcd_handle_write(&t->lcd, 2, "41", 2);
+	expect_ops(test, third_row, ARRAY_SIZE(third_row));
+	lcd_handle_write(&t->lcd, 2, "80", 2);
+	expect_ops(test, last, ARRAY_SIZE(last));
+	lcd_handle_write(&t->lcd, 2, "81", 2);
+	expect_ops(test, NULL, 0);
+
+	// The characters written at the end of the first row continue in the third, like the display does
+	lcd_goto(&t->lcd, 0x13);
+	lcd_handle_write(&t->lcd, 0, "ab", 2);
+	KUNIT_EXPECT_EQ(test, t->lcd.shadow[19], 'a');
+	KUNIT_EXPECT_EQ(test, t->lcd.shadow[40], 'b');
+}
+
+static void test_encode(struct kunit * test)
+{
+	// An I2C expander wiring: RS on P0, EN on P2, and the data on P4 to P7
+	static const unsigned char bit[ENC_PINS] = { 0x01, 0x04, 0x10, 0x20, 0x40, 0x80 };
+	static const unsigned char a[] = { 0x45, 0x41, 0x15, 0x11 };		// 'A' (0x41) as a character
+	static const unsigned char cls[] = { 0x04, 0x00, 0x14, 0x10 };		// Clear Display (0x01) as a command
+	struct lcd_encoding * enc = kunit_kzalloc(test, sizeof(*enc), GFP_KERNEL);
+	unsigned char out[2 * ENC_STATES];
+
+	KUNIT_ASSERT_NOT_NULL(test, enc);
+	lcd_encode_init(enc, bit);
+
+	KUNIT_EXPECT_EQ(test, memcmp(enc->seq[1]['A'], a, ENC_STATES), 0);
+	KUNIT_EXPECT_EQ(test, memcmp(enc->seq[0][0x01], cls, ENC_STATES), 0);
+
+	KUNIT_EXPECT_EQ(test, lcd_encode(enc, 1, "AA", 2, out), 2 * ENC_STATES);
+	KUNIT_EXPECT_EQ(test, memcmp(&out[ENC_STATES], a, ENC_STATES), 0);
+}
+
+// Frames that differ in a single cell, or only in the cells after n, have different hashes
+static void test_hash(struct kunit * test)
+{
+	unsigned char a[CELLS];
+	unsigned char b[CELLS];
+
+	memset(a, ' ', CELLS);
+	memcpy(b, a, CELLS);
+	KUNIT_EXPECT_EQ(test, lcd_hash(a, CELLS), lcd_hash(b, CELLS));
+
+	b[CELLS - 1] = 'A';
+	KUNIT_EXPECT_NE(test, lcd_hash(a, CELLS), lcd_hash(b, CELLS));
+	KUNIT_EXPECT_EQ(test, lcd_hash(a, CELLS - 1), lcd_hash(b, CELLS - 1));
+
+	// The same characters in other cells
+	b[CELLS - 1] = ' ';
+	b[0] = 'A';
+	a[1] = 'A';
+	KUNIT_EXPECT_NE(test, lcd_hash(a, CELLS), lcd_hash(b, CELLS));
+}
+
+// A small pseudo random generator, so the workloads are the same in every run
+static u32 bench_rand(u32 * seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 16;
+}
+
+static void test_plan_benchmark(struct kunit * test)
+{
+	struct mock_test * t = test->priv;
+	static const char * const names[] = { "single cell", "full redraw", "scrolling" };
+	unsigned char frame[CELLS];
+	struct lcd_plan plan;
+	unsigned long bytes;
+	u32 seed = 1;
+	ktime_t start;
+	u64 ns;
+	int w;
+	int x;
+	int y;
+
+	for(w = 0; w < ARRAY_SIZE(names); w++)
+	{
+		lcd_core_init(&t->lcd, &mock, &t->bus);
+		memset(frame, ' ', CELLS);
+		bytes = 0;
+
+		start = ktime_get();
+		for(x = 0; x < 10000; x++)
+		{
+			if(w == 0)			// A random cell changes
+				frame[bench_rand(&seed) % CELLS] = 'A' + x % 26;
+			else if(w == 1)		// Every cell changes
+				memset(frame, 'A' + x % 26, CELLS);
+			else				// The text moves one position to the left
+				for(y = 0; y < CELLS; y++)
+					frame[y] = 'A' + (x + y) % 26;
+
+			lcd_plan(&t->lcd, frame, &plan);
+			t->bus.count = 0;
+			lcd_run(&t->lcd, &plan);
+			bytes += plan.count;
+		}
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		kunit_info(test, "%s: %llu ns per frame, %lu bytes per frame\n", names[w], div_u64(ns, 10000), bytes / 10000);
+	}
+}
+
+static struct kunit_case displaylcd_cases[] = {
+	KUNIT_CASE(test_cls),
+	KUNIT_CASE(test_pos),
+	KUNIT_CASE(test_write),
+	KUNIT_CASE(test_write_limit),
+	KUNIT_CASE(test_wrap),
+	KUNIT_CASE(test_plan),
+	KUNIT_CASE(test_rtl),
+	KUNIT_CASE(test_charmap),
+	KUNIT_CASE(test_geometry),
+	KUNIT_CASE(test_encode),
+	KUNIT_CASE(test_hash),
+	KUNIT_CASE(test_plan_benchmark),
+	{}
+};
+
+static struct kunit_suite displaylcd_suite = {
+	.name = "displaylcd",
+	.init = mock_init,
+	.test_cases = displaylcd_cases,
+};
+kunit_test_suite(displaylcd_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit tests for the displaylcd driver core");
@@ -0,0 +1,2838 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/delay.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/sort.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/fault-inject.h>
+#include <linux/jump_label.h>
+#include <linux/static_call.h>
+
+#include "displaylcd.h"
+#include "displaylcd_core.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Christian Schultz");
+MODULE_DESCRIPTION("A LKM to use a 16x2 Alphanumeric Display with the Raspberry Pi");
+MODULE_VERSION("1.0");
+
+// Here, the pin names are defined to his respective pin number.
+// To change the circuit connection, just change the defines below according to the schematic
+#define RS_pin	10
+#define EN_pin	9
+#define DB4_pin	6
+#define DB5_pin	13
+#define DB6_pin	19
+#define DB7_pin	26
+
+// This structure defines an gpio array. The GPIO pin number is defined in a series of #define's just above
+static struct gpio pins[] = {
+	{ RS_pin,  GPIOF_OUT_INIT_LOW, "LCD RS pin"  },
+	{ EN_pin,  GPIOF_OUT_INIT_LOW, "LCD EN pin"  },
+	{ DB4_pin, GPIOF_OUT_INIT_LOW, "LCD DB4 pin" },
+	{ DB5_pin, GPIOF_OUT_INIT_LOW, "LCD DB5 pin" },
+	{ DB6_pin, GPIOF_OUT_INIT_LOW, "LCD DB6 pin" },
+	{ DB7_pin, GPIOF_OUT_INIT_LOW, "LCD DB7 pin" }
+};                                            
+
+// The defines below are used to access the gpio array member, declared above
+#define RS 0
+#define EN 1
+#define DB4 2
+#define DB5 3
+#define DB6 4
+#define DB7 5
+
+// When the GPIO controller can change several pins in a single call, lcd_byte sends each nibble with 2 calls (the data with EN high, then EN low)
+// instead of changing the pins one by one. The pin states of every byte are computed when the module is loaded (see lcd_encode_init)
+static bool bulk = true;
+module_param(bulk, bool, 0444);
+MODULE_PARM_DESC(bulk, "Change all the display pins at once (1, the default) or one by one (0)");
+static struct gpio_desc * descs[ENC_PINS + DISPLAYLCD_MAX_DISPLAYS - 1];	// The pins array as GPIO descriptors (for gpiod_set_raw_array_value), then the extra_en pins
+static struct lcd_encoding enc;
+static int rs_level = 0;					// The state of the RS pin, which is the same in all the states of a byte
+
+// The delays used by lcd_nibble around the EN pulse, according to the HD44780 datasheet (page 58, figure 25)
+#define EN_SETUP_NS 150		// From EN high to the data pins change
+#define EN_HOLD_NS 80		// From the data pins change to EN low
+#define EN_AFTER_NS 10		// After EN low, before the next nibble
+
+// The GPIO changes take time too (around 500ns each on a Raspberry Pi 3), and the time between two pin changes is the delay plus the change.
+// So, when the module is loaded, the time of a GPIO change is measured (lcd_measure_gpio) and subtracted from the delays above, and a delay
+// that is shorter than the GPIO change is not made at all. The delays used are shown in /sys/kernel/debug/displaylcd/timing
+static bool compensate = true;
+module_param(compensate, bool, 0444);
+MODULE_PARM_DESC(compensate, "Subtract the measured time of the GPIO changes from the EN pulse delays (1, the default) or not (0)");
+static unsigned int gpio_ns = 0;				// Time of gpio_set_value, measured when the module is loaded
+static unsigned int array_ns = 0;				// Time of gpiod_set_raw_array_value
+static unsigned int setup_ns = EN_SETUP_NS;		// The delays of lcd_nibble...
+static unsigned int hold_ns = EN_HOLD_NS;
+static unsigned int after_ns = EN_AFTER_NS;
+static unsigned int pulse_ns = EN_SETUP_NS + EN_HOLD_NS;	// ...and the ones of lcd_byte_bulk
+static unsigned int bulk_after_ns = EN_AFTER_NS;
+
+// The time the display needs to execute the commands. With its nominal 270kHz oscillator, the HD44780 takes 37us for most commands and 1.52ms
+// for the Clear Display and Return Home (datasheet, page 24), but some compatible controllers, and the HD44780 itself at 3.3V, are slower.
+// The EN pulses can't come closer than the enable cycle time (tcycE), 500ns at 5V and 1000ns at 3.3V.
+// The profile is chosen in /sys/class/displaylcdclass/displaylcd/timing
+struct lcd_timing {
+	const char * name;
+	unsigned int cmd_us;		// Wait after any byte
+	unsigned int clear_ms;		// Wait after the Clear Display and Return Home commands
+	unsigned int cycle_ns;		// From one EN rising edge to the next (tcycE)
+};
+static const struct lcd_timing timings[] = {
+	{ "hd44780", 40, 2, 500 },
+	{ "slow", 80, 5, 1000 },
+};
+static const struct lcd_timing * timing = &timings[0];
+
+// This global variables are used as placeholders, if no parameters are passed to the module when loading it
+static char * line1 = " Raspberry Pi 3 ";
+static char * line2 = "  LCD  Display  "; 
+
+// Declare the module parameters settings
+module_param(line1, charp, 0000);
+module_param(line2, charp, 0000);
+MODULE_PARM_DESC(line1, "The characters to be displayed in the first (upper) line of the LCD Display (max number of chars: 16)");
+MODULE_PARM_DESC(line2, "The characters to be displayed in the second (lower) line of the LCD Display (max number of chars: 16)");
+
+// In the original circuit the RW pin of the display is tied to ground, and the driver can only write. If it is connected to a GPIO, the driver
+// reads the busy flag and the address counter after every byte, to find out if the display is still there (see lcd_check).
+// Beware: a display powered with 5V drives the data pins with 5V when it is read, and the Raspberry Pi pins only stand 3.3V. Use a 3.3V display
+// or a level shifter on DB4 to DB7 before setting this parameter.
+static int rw_pin = -1;
+module_param(rw_pin, int, 0444);
+MODULE_PARM_DESC(rw_pin, "The GPIO connected to the RW pin of the display, to read the busy flag (-1 when RW is tied to ground)");
+
+// More displays can share the RS and data pins, each one with its own EN pin: a display ignores the data pins while its EN pin is low.
+// They are numbered from 1, in the order of this parameter, and are written with the DISPLAYLCD_IOC_BATCH ioctl (display 0 is the usual one).
+// Their EN pins follow the pins array in descs, so a byte is sent to several displays at once by pulsing all their EN pins (see en_mask)
+static int extra_en[DISPLAYLCD_MAX_DISPLAYS - 1];
+static int nextra = 0;
+module_param_array(extra_en, int, &nextra, 0444);
+MODULE_PARM_DESC(extra_en, "The GPIOs connected to the EN pins of more displays, which share the RS and data pins of the first one");
+#define EN_BIT(d) ((d) ? 1UL << (ENC_PINS + (d) - 1) : 1UL << EN)	// The bit of the EN pin of display d in descs
+static unsigned long en_mask = EN_BIT(0);		// The EN pins pulsed by the next byte, as bits of descs
+static struct lcd_core others[DISPLAYLCD_MAX_DISPLAYS - 1];	// The state of the displays of extra_en, display d is others[d - 1]
+static unsigned long extra_faults = 0;			// Bytes that failed on the displays of extra_en
+
+// Where the characters of display 0 go: the CGRAM address while lcd_glyph sends the rows of a custom character, or -1 when they go to the
+// display memory. A recovery leaves the address counter in the display memory, so the CGRAM address is set again before the byte is retried
+static int cgaddr = -1;
+
+// Function prototypes
+int lcd_nibble(unsigned char);		// Writes a single nibble to the LCD
+int lcd_byte(unsigned char);		// Writes a byte to LCD, call lcd_nibble twice
+static int lcd_hw_init(void);		// Sends the initialization sequence to the display
+void lcd_gpio_write(void *, unsigned char, int);	// Sends a command or a character through the GPIO pins, this is the bus used by the core
+static int lcd_batch_send(const struct lcd_plan *, const unsigned long *);	// Sends the plans of several displays at the same time
+static void lcd_delays(void);		// Computes the delays around the EN pulse, from the measured GPIO times and the timing profile
+// Methods prototypes
+static int device_open(struct inode *, struct file *);						// This method is called when a program open the device file
+static int device_release(struct inode *, struct file *);					// Called when the program closes the device file
+static ssize_t device_read(struct file *, char *, size_t, loff_t *);		// Called when the program that opened the device file reads it
+static ssize_t device_write(struct file *, const char *, size_t, loff_t *);	// Called when the program that opened the device file writes to it
+static long device_ioctl(struct file *, unsigned int, unsigned long);		// Called when the program that opened the device file sends an ioctl command
+static __poll_t device_poll(struct file *, poll_table *);					// Called when the program waits (poll or select) for the display content to change
+static char * classmode(struct device *, umode_t *);
+
+// More global variables
+static int Device_Open = 0;				// This flag is used to prevent multiple device driver file opening
+static struct class * devclass = NULL;	// This structure will hold the device driver class
+static struct device * dev = NULL;		// This structur will hole the device driver that will be created
+static int major;						// Here I will keep the major number assigned by the kernel
+static DEFINE_MUTEX(lcd_mutex);			// Only one write at a time can talk to the display, otherwise the nibbles of two programs would be mixed
+static unsigned long bus_bytes = 0;		// Counts every byte sent to the display by lcd_byte, used by the bus time accounting below
+static struct dentry * debugdir = NULL;	// The /sys/kernel/debug/displaylcd directory, where the diagnostic files are placed
+static struct lcd_core lcd;				// The display state (shadow and cursor), see displaylcd_core.h
+static u64 bus_ns_total = 0;			// Bus time of all writes, together with bus_bytes_total gives the average cost of a byte
+static u64 bus_bytes_total = 0;			// Bytes sent by all writes (the initialization is not counted, it was not timed)
+static u64 shadow_gen = 0;				// Incremented every time the shadow changes, so readers know when there's something new to read
+static DECLARE_WAIT_QUEUE_HEAD(shadow_wait);	// The programs waiting for the shadow to change sleep here
+static ktime_t op_start;				// When the current operation (a write or an ioctl) got the display, see lcd_lock
+static unsigned long op_bytes;			// The value of bus_bytes when the current operation got the display
+
+// Every opened device file has one of these, stored in file->private_data
+struct lcd_file {
+	int minor;		// The minor number used to open the device (0 is /dev/displaylcd, 1 is /dev/displaylcd_cls, 2 is /dev/displaylcd_pos, 3 is /dev/displaylcd_log)
+	u64 seen;		// The shadow generation this file last read
+};
+
+// Bus time accounting. Every write that reaches the display is charged to the process that issued it, so it is possible to find
+// out who is keeping the display busy. The table is small, when it is full the entry with less bus time is recycled.
+#define ACCT_SLOTS 16
+struct lcd_acct {
+	pid_t pid;					// The process (thread group) id
+	char comm[TASK_COMM_LEN];	// The process name, as seen when it first wrote to the display
+	u64 bus_ns;					// Total time spent talking to the display on behalf of this process
+	u64 bytes;					// Total bytes (commands and characters) sent to the display
+	u64 flushes;				// Number of writes that reached the display
+};
+static struct lcd_acct acct[ACCT_SLOTS];
+
+// Bus utilization. The busy time of the display is summed in one second slots, the last 60 seconds are kept, which is enough to
+// calculate the utilization over 1, 10 and 60 seconds windows. A slot is reused when its second is older than a minute.
+#define UTIL_SLOTS 60
+static u64 busy_ns[UTIL_SLOTS];			// Bus time (strobing the pins and waiting the display execute the commands) used in each second
+static time64_t busy_sec[UTIL_SLOTS];	// The second each slot belongs to
+static u64 writes = 0;					// Number of writes received
+static u64 contended = 0;				// Writes that found the display busy with another write and had to wait (the display is saturated)
+static u64 dropped = 0;					// Writes thrown away, because they were too long
+
+// Every byte keeps the CPU busy (the driver waits the display with udelay), and a whole frame takes milliseconds. To keep the other tasks
+// running on time (like sensors polled on the same CPU), a frame can be sent in pieces of at most max_hold_us, giving the CPU away between
+// them. The display keeps its address counter between two bytes, so a piece can end after any byte. The display stays locked for the whole
+// frame, so other writes still see it shown at once. 0 (the default) sends the frame in one piece
+static unsigned int max_hold_us = 0;
+module_param(max_hold_us, uint, 0644);
+MODULE_PARM_DESC(max_hold_us, "The longest time a frame keeps the CPU before letting other tasks run, in microseconds (0 for no limit)");
+static u64 hold_yields = 0;		// Times a frame was split
+static u64 hold_max_ns = 0;		// The longest piece sent
+
+// Log view. The lines written to /dev/displaylcd_log are kept in a ring of log_depth lines, and the display shows the newest ones, like a
+// terminal. The DISPLAYLCD_IOC_SCROLL ioctl moves the view back through the older lines (and forward again), so the program only appends
+// lines and the driver redraws the cells that changed. A line without '\n' at the end is continued by the next write
+#define LOG_MINOR 3
+static unsigned int log_depth = 64;
+module_param(log_depth, uint, 0444);
+MODULE_PARM_DESC(log_depth, "The number of lines kept by /dev/displaylcd_log (0 disables it)");
+static char * log_ring = NULL;			// log_depth lines of MAX_CELLS characters (the display shows the first cols of them)
+static unsigned int log_lines = 0;		// Lines in the ring
+static unsigned int log_newest = 0;		// Where the newest line is in the ring
+static unsigned int log_col = 0;		// Characters in the newest line
+static bool log_newline = true;			// The next character starts a new line
+static unsigned int log_scroll = 0;		// How many lines back from the newest the view is
+
+// Animations. A program gives the driver a region of the display and up to DISPLAYLCD_ANIM_FRAMES texts for it (DISPLAYLCD_IOC_ANIMATE),
+// and the driver shows them one after the other, every period_ms. Blinking a field is a text and spaces. The steps are made by anim_work,
+// which sends only the cells that changed, so the program doesn't wake up for every step
+#define ANIM_MIN_MS 50		// Faster than this, the display (which takes tens of ms to change its pixels) would only show a blur
+struct lcd_anim {
+	bool active;
+	unsigned char cell;			// The first cell of the region
+	unsigned char width;
+	unsigned char nframes;
+	unsigned char step;			// The frame being shown
+	unsigned long period;		// In jiffies
+	unsigned long next;			// When the next frame is due
+	pid_t pid;					// The process that started the animation, its steps are recorded in the frame history under it
+	char comm[TASK_COMM_LEN];
+	char frames[DISPLAYLCD_ANIM_FRAMES][MAX_CELLS];
+};
+static struct lcd_anim anims[DISPLAYLCD_MAX_ANIMS];
+static u64 anim_steps = 0;		// Frames shown by the animations
+static void lcd_anim_step(struct work_struct *);
+static DECLARE_DELAYED_WORK(anim_work, lcd_anim_step);
+
+// Character translation. When a table is loaded (DISPLAYLCD_IOC_CHARMAP), the writes to /dev/displaylcd are UTF-8 text, translated to the codes
+// of the display by lcd_translate. The glyphs are kept, because the display forgets them when it is initialized again (see lcd_reinit)
+static struct lcd_charmap charmap;
+static struct lcd_charmap charmap_next;		// Where a new table is built, so a table that is not valid doesn't replace the one in use
+static bool charmap_on = false;
+static unsigned char glyphs[DISPLAYLCD_GLYPHS][8];
+static unsigned int glyph_mask = 0;			// The glyphs loaded
+
+// Frame history. Every time a write changes the display, the new frame is recorded with the time and the process that wrote it, so after
+// an incident it is possible to know what the display was showing. To keep it cheap, only the changed cells are stored (as cell/character pairs)
+// in a circular pool of bytes. The frame before the oldest entry is kept in hist_base, so every recorded frame can be rebuilt from it.
+#define HIST_ENTRIES 64
+#define HIST_POOL 1024
+struct lcd_hist {
+	u64 ns;						// Wall clock time of the change
+	pid_t pid;					// The process that changed the display
+	char comm[TASK_COMM_LEN];
+	unsigned short start;		// Where the changes begin in hist_pool
+	unsigned char count;		// Number of changed cells
+};
+static struct lcd_hist hist[HIST_ENTRIES];
+static unsigned char hist_pool[HIST_POOL];
+static int hist_first = 0;					// The oldest entry
+static int hist_count = 0;					// Number of entries in use
+static unsigned int hist_used = 0;			// Bytes of hist_pool in use
+static unsigned int hist_head = 0;			// Where the changes of the next entry will be stored in hist_pool
+static unsigned char hist_base[MAX_CELLS];	// The frame before the oldest entry
+static unsigned char hist_last[MAX_CELLS];	// The frame after the newest entry
+
+// Operation trace. When enabled (/sys/kernel/debug/displaylcd/trace_enable), every write and frame update is recorded with its time and data,
+// and can be read from /sys/kernel/debug/displaylcd/trace. The tools/lcdreplay program sends a trace back to the driver or to the emulator.
+#define TRACE_ENTRIES 256
+#define TRACE_PRINT 0	// The trace operations are the minor numbers of the device files written (print, cls and pos)...
+#define TRACE_CLS 1
+#define TRACE_POS 2
+#define TRACE_SHOW 3	// ...plus the DISPLAYLCD_IOC_SHOW frames
+#define TRACE_MODE 4	// ...and the DISPLAYLCD_IOC_MODE changes, as the Display On/Off Control and Entry Mode Set commands
+struct lcd_trace {
+	u64 ns;						// Monotonic time of the operation
+	unsigned char op;
+	unsigned char len;			// Bytes in data
+	char data[4 * 30];			// A frame, or a write of 30 characters in UTF-8 (see device_write)
+};
+static struct lcd_trace trace[TRACE_ENTRIES];
+static int trace_first = 0;					// The oldest entry
+static int trace_count = 0;					// Number of entries in use
+static bool trace_enable = false;
+static const char * const trace_ops[] = { "print", "cls", "pos", "show", "mode" };
+
+// EN pulse timing. When enabled (/sys/kernel/debug/displaylcd/jitter_enable), lcd_nibble takes note of how long the EN pin stayed high
+// (the pulse) and how long it took between the two nibbles of a byte (the gap). Preemption and interrupts make these times longer than
+// the delays asked to ndelay, and /sys/kernel/debug/displaylcd/jitter shows the distribution. The last JITTER_SAMPLES of each are kept.
+#define JITTER_SAMPLES 2048
+static DEFINE_STATIC_KEY_FALSE(jitter_key);	// Enabled by jitter_enable, the measurements cost nothing while it is off
+static u32 jitter_pulse[JITTER_SAMPLES];	// EN pulse widths, in nanoseconds
+static u32 jitter_gap[JITTER_SAMPLES];		// Gaps between the nibbles of a byte (from EN low to the next EN high), in nanoseconds
+static unsigned long jitter_npulse = 0;		// Number of pulses measured (the next sample goes to jitter_npulse % JITTER_SAMPLES)
+static unsigned long jitter_ngap = 0;
+static u64 jitter_low = 0;					// When EN went low in the last nibble
+static bool jitter_second = false;			// Set by lcd_byte while it sends the second nibble
+
+// Bus errors. When a byte can't be sent, it is retried; if it still fails, the display is initialized again and redrawn from the shadow;
+// and if that fails too, the display is marked offline. While offline, writes only update the shadow (so they don't wait for a dead display),
+// and the display is probed every PROBE_INTERVAL until it answers again, when it is redrawn. gpio_set_value can't report errors, so the
+// errors come from the fault injection framework (/sys/kernel/debug/displaylcd/fail_gpio, see Documentation/fault-injection). The faults are
+// only asked for after /sys/kernel/debug/displaylcd/fail_gpio_enable is set to 1, until then the pin changes don't call should_fail.
+#define BYTE_RETRIES 2
+#define PROBE_INTERVAL HZ
+#ifdef CONFIG_FAULT_INJECTION
+static DECLARE_FAULT_ATTR(fail_gpio);
+static DEFINE_STATIC_KEY_FALSE(fault_key);	// Enabled by fail_gpio_enable, once fail_gpio is configured
+#define lcd_should_fail() (static_branch_unlikely(&fault_key) && should_fail(&fail_gpio, 1))
+#else
+#define lcd_should_fail() false
+#endif
+static bool offline = false;			// The display is not answering
+static u64 fault_start = 0;				// When the current error episode started (0 if there's none)
+static unsigned long faults = 0;		// Bytes that failed
+static unsigned long retries = 0;		// Bytes sent again after failing
+static unsigned long reinits = 0;		// Times the display was initialized again
+static unsigned long reinit_failures = 0;
+static unsigned long offline_count = 0;	// Times the display went offline
+static unsigned long recoveries = 0;	// Error episodes that ended with the display working
+static u64 recovery_last_ns = 0;		// Time from the first error to the recovery, of the last episode
+static u64 recovery_max_ns = 0;
+static void lcd_probe(struct work_struct *);
+static DECLARE_DELAYED_WORK(probe_work, lcd_probe);
+
+// The checks made when the RW pin is connected (see rw_pin)
+#define BUSY_TIMEOUT_NS 2000000		// No command takes this long, a display that stays busy for 2ms is not working
+static int ac = -1;						// The address counter the display should have now, -1 if it is not known
+static unsigned long busy_timeouts = 0;	// Times the busy flag didn't clear in time
+static unsigned long ac_mismatches = 0;	// Times the address counter read back was not the expected one
+static DEFINE_STATIC_KEY_FALSE(readback_key);	// Enabled when the RW pin was requested
+
+// Declare the methods to be called when such action happens
+static struct file_operations fops = {
+	.read = device_read,
+	.write = device_write,
+	.open = device_open,
+	.release = device_release,
+	.unlocked_ioctl = device_ioctl,
+	.poll = device_poll,
+	.llseek = default_llseek
+};
+
+// The core talks to the display through this bus
+static const struct lcd_bus gpio_bus = {
+	.write = lcd_gpio_write
+};
+
+// This method is called when the program issues an open command. It is important to have only one program that can write to the device file at a time (I think).
+// So, a flag is marked whenever the file is opened for writing, so if there's another try to open it, the opening is recused by returning an error code.
+// Programs that only read the display content (like a mirror of the display) don't change it, so any number of them can open the device file.
+static int device_open(struct inode * inode, struct file * file)
+{
+	struct lcd_file * lf;
+
+	if(file->f_mode & FMODE_WRITE)
+	{
+		if(Device_Open)		// If this flag is marked, I will not do anything and return with an error code
+			return -EBUSY;
+	}
+
+	lf = kzalloc(sizeof(*lf), GFP_KERNEL);
+	if(!lf)
+		return -ENOMEM;
+
+	if(file->f_mode & FMODE_WRITE)
+		Device_Open = 1;	// Mark the flag to show that the device is opened by someone
+	
+	// This command increments the use counter. If it is not zero, rmmod will not allow the module to be removed
+	// The counter is decremented on device_release method
+	try_module_get(THIS_MODULE);
+
+	lf->minor = MINOR(inode->i_rdev);	// Store the minor number used to open the device
+	file->private_data = lf;
+
+	return 0;
+}
+
+// This method is called when the program closes the device driver file. The flag that shows that the file is opened is cleared, so another program 
+// can try to open the driver.
+static int device_release(struct inode * inode, struct file * file)
+{
+	if(file->f_mode & FMODE_WRITE)
+		Device_Open = 0;	// Clear the flag to allow the device driver file to be opened by another program
+
+	kfree(file->private_data);
+
+	// This command decrements the use counter, so if it is zero, rmmod can remove the module (if needed)
+	module_put(THIS_MODULE);
+
+	return 0;
+}
+
+// Reading /dev/displaylcd gives the generation of the content (a number that increments every time it changes) in the first line,
+// followed by the display rows, one per line. To read it again, the program must seek back to the beginning of the file.
+static ssize_t device_read(struct file * filp, char * buffer, size_t length, loff_t * offset)
+{
+	struct lcd_file * lf = filp->private_data;
+	char text[24 + MAX_CELLS + MAX_ROWS];
+	int n;
+	int x;
+
+	if(lf->minor != 0)	// Only /dev/displaylcd has something to read
+		return 0;
+
+	mutex_lock(&lcd_mutex);
+	n = scnprintf(text, sizeof(text), "%llu\n", shadow_gen);
+	for(x = 0; x < lcd.rows; x++)
+	{
+		memcpy(&text[n], &lcd.shadow[x * lcd.cols], lcd.cols);
+		n += lcd.cols;
+		text[n++] = '\n';
+	}
+	lf->seen = shadow_gen;
+	mutex_unlock(&lcd_mutex);
+
+	return simple_read_from_buffer(buffer, length, offset, text, n);
+}
+
+// A program waiting on /dev/displaylcd is woken with POLLPRI when the content changed since the last time it read the file
+static __poll_t device_poll(struct file * filp, poll_table * wait)
+{
+	struct lcd_file * lf = filp->private_data;
+	__poll_t mask = POLLIN | POLLRDNORM;	// There is always something to read
+
+	if(lf->minor != 0)
+		return mask;
+
+	poll_wait(filp, &shadow_wait, wait);
+
+	mutex_lock(&lcd_mutex);
+	if(lf->seen != shadow_gen)
+		mask |= POLLPRI;
+	mutex_unlock(&lcd_mutex);
+
+	return mask;
+}
+
+// This function charges the bus time and bytes of one write to the process that issued it
+static void lcd_account(u64 bus_ns, unsigned long bytes)
+{
+	pid_t pid = task_tgid_nr(current);
+	struct lcd_acct * slot = &acct[0];
+	int x;
+
+	// Look for the process in the table. If it is not there, the slot with the smallest bus time is reused
+	for(x = 0; x < ACCT_SLOTS; x++)
+	{
+		if(acct[x].pid == pid)
+		{
+			slot = &acct[x];
+			break;
+		}
+		if(acct[x].bus_ns < slot->bus_ns)
+			slot = &acct[x];
+	}
+
+	if(slot->pid != pid)
+	{
+		memset(slot, 0, sizeof(*slot));
+		slot->pid = pid;
+		get_task_comm(slot->comm, current);
+	}
+
+	slot->bus_ns += bus_ns;
+	slot->bytes += bytes;
+	slot->flushes++;
+}
+
+// This function adds the bus time of one write to the utilization slot of the current second
+static void lcd_busy(u64 ns)
+{
+	time64_t now = ktime_get_seconds();
+	int slot = now % UTIL_SLOTS;
+
+	if(busy_sec[slot] != now)	// The slot has data from a minute ago (or more), so it starts again from zero
+	{
+		busy_sec[slot] = now;
+		busy_ns[slot] = 0;
+	}
+	busy_ns[slot] += ns;
+}
+
+// Returns the bus utilization in the last "seconds" complete seconds, in tenths of percent (permille)
+static unsigned int lcd_utilization(int seconds)
+{
+	time64_t now = ktime_get_seconds();
+	u64 total = 0;
+	int x;
+
+	for(x = 0; x < UTIL_SLOTS; x++)
+		if((busy_sec[x] < now) && (busy_sec[x] >= now - seconds))
+			total += busy_ns[x];
+
+	return div64_u64(total, (u64)seconds * (NSEC_PER_SEC / 1000));
+}
+
+// Adds an operation to the trace. When the trace is full, the oldest entry is overwritten
+static void lcd_trace(unsigned char op, const char * data, size_t len)
+{
+	struct lcd_trace * t;
+
+	if(!trace_enable)
+		return;
+
+	if(trace_count == TRACE_ENTRIES)
+	{
+		trace_first = (trace_first + 1) % TRACE_ENTRIES;
+		trace_count--;
+	}
+
+	t = &trace[(trace_first + trace_count) % TRACE_ENTRIES];
+	t->ns = ktime_get_ns();
+	t->op = op;
+	t->len = min(len, sizeof(t->data));
+	memcpy(t->data, data, t->len);
+	trace_count++;
+}
+
+// Removes the oldest entry from the frame history, its changes go to hist_base
+static void lcd_hist_drop(void)
+{
+	struct lcd_hist * h = &hist[hist_first];
+	int x;
+
+	for(x = 0; x < h->count; x++)
+		hist_base[hist_pool[(h->start + 2 * x) % HIST_POOL]] = hist_pool[(h->start + 2 * x + 1) % HIST_POOL];
+
+	hist_used -= 2 * h->count;
+	hist_first = (hist_first + 1) % HIST_ENTRIES;
+	hist_count--;
+}
+
+// Records the shadow in the frame history, storing only the cells that are different from the previous frame
+// Records the shadow in the frame history, as changed by owner (or by the current process when owner is NULL)
+static void lcd_hist_record(const struct lcd_anim * owner)
+{
+	struct lcd_hist * h;
+	unsigned int count = 0;
+	unsigned int pos;
+	int x;
+
+	for(x = 0; x < lcd_cells(&lcd); x++)
+		if(lcd.shadow[x] != hist_last[x])
+			count++;
+
+	if(count == 0)	// The same frame again, there is nothing to record
+		return;
+
+	// Make room for the new entry, dropping the oldest ones
+	while((hist_count == HIST_ENTRIES) || (hist_used + 2 * count > HIST_POOL))
+		lcd_hist_drop();
+
+	h = &hist[(hist_first + hist_count) % HIST_ENTRIES];
+	h->ns = ktime_get_real_ns();
+	if(owner)
+	{
+		h->pid = owner->pid;
+		memcpy(h->comm, owner->comm, sizeof(h->comm));
+	}
+	else
+	{
+		h->pid = task_tgid_nr(current);
+		get_task_comm(h->comm, current);
+	}
+	h->start = hist_head;
+	h->count = count;
+
+	pos = h->start;
+	for(x = 0; x < lcd_cells(&lcd); x++)
+	{
+		if(lcd.shadow[x] == hist_last[x])
+			continue;
+		hist_pool[pos] = x;
+		hist_pool[(pos + 1) % HIST_POOL] = lcd.shadow[x];
+		pos = (pos + 2) % HIST_POOL;
+		hist_last[x] = lcd.shadow[x];
+	}
+
+	hist_head = pos;
+	hist_used += 2 * count;
+	hist_count++;
+}
+
+// Empties the frame history, which starts again from what the display is showing now. Used when the display geometry changes,
+// because the old frames don't fit in the new one
+static void lcd_hist_reset(void)
+{
+	hist_first = 0;
+	hist_count = 0;
+	hist_used = 0;
+	hist_head = 0;
+	memcpy(hist_base, lcd.shadow, sizeof(hist_base));
+	memcpy(hist_last, lcd.shadow, sizeof(hist_last));
+}
+
+// Used by sort() to put the biggest bus time consumers first
+static int acct_cmp(const void * a, const void * b)
+{
+	const struct lcd_acct * x = a;
+	const struct lcd_acct * y = b;
+
+	if(x->bus_ns == y->bus_ns)
+		return 0;
+	return x->bus_ns > y->bus_ns ? -1 : 1;
+}
+
+// Shows the contents of /sys/kernel/debug/displaylcd/consumers, the processes that used the display, sorted by the bus time
+static int consumers_show(struct seq_file * m, void * v)
+{
+	struct lcd_acct table[ACCT_SLOTS];
+	int x;
+
+	// I work on a copy of the table, so the display is not blocked while the text is formatted
+	mutex_lock(&lcd_mutex);
+	memcpy(table, acct, sizeof(table));
+	mutex_unlock(&lcd_mutex);
+
+	sort(table, ACCT_SLOTS, sizeof(table[0]), acct_cmp, NULL);
+
+	seq_printf(m, "%-8s %-16s %12s %10s %10s\n", "pid", "comm", "bus_us", "bytes", "flushes");
+	for(x = 0; x < ACCT_SLOTS; x++)
+	{
+		if(table[x].flushes == 0)	// Unused slot
+			continue;
+		seq_printf(m, "%-8d %-16s %12llu %10llu %10llu\n", table[x].pid, table[x].comm,
+			div_u64(table[x].bus_ns, NSEC_PER_USEC), table[x].bytes, table[x].flushes);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(consumers);
+
+// Shows the contents of /sys/kernel/debug/displaylcd/utilization: how much of the time the display was busy and how many writes had to wait or were lost
+static int utilization_show(struct seq_file * m, void * v)
+{
+	static const int windows[] = { 1, 10, 60 };
+	unsigned int util;
+	int x;
+
+	mutex_lock(&lcd_mutex);
+
+	for(x = 0; x < ARRAY_SIZE(windows); x++)
+	{
+		util = lcd_utilization(windows[x]);
+		seq_printf(m, "busy_%ds: %u.%u%%\n", windows[x], util / 10, util % 10);
+	}
+	seq_printf(m, "writes: %llu\n", writes);
+	seq_printf(m, "contended: %llu\n", contended);
+	seq_printf(m, "dropped: %llu\n", dropped);
+	seq_printf(m, "hold_yields: %llu\n", hold_yields);
+	seq_printf(m, "hold_max_us: %llu\n", div_u64(hold_max_ns, NSEC_PER_USEC));
+	seq_printf(m, "anim_steps: %llu\n", anim_steps);
+
+	mutex_unlock(&lcd_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(utilization);
+
+// Shows the contents of /sys/kernel/debug/displaylcd/history, the last frames shown on the display, from the oldest to the newest
+static int history_show(struct seq_file * m, void * v)
+{
+	unsigned char frame[MAX_CELLS];
+	struct lcd_hist * h;
+	u32 rem;
+	u64 sec;
+	int x;
+	int y;
+
+	mutex_lock(&lcd_mutex);
+
+	memcpy(frame, hist_base, sizeof(frame));
+	for(x = 0; x < hist_count; x++)
+	{
+		h = &hist[(hist_first + x) % HIST_ENTRIES];
+		for(y = 0; y < h->count; y++)
+			frame[hist_pool[(h->start + 2 * y) % HIST_POOL]] = hist_pool[(h->start + 2 * y + 1) % HIST_POOL];
+
+		sec = div_u64_rem(h->ns, NSEC_PER_SEC, &rem);
+		seq_printf(m, "%llu.%06u %d %s\n", sec, rem / 1000, h->pid, h->comm);
+		for(y = 0; y < lcd.rows; y++)
+			seq_printf(m, "  |%.*s|\n", lcd.cols, &frame[y * lcd.cols]);
+	}
+
+	mutex_unlock(&lcd_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(history);
+
+// Shows the contents of /sys/kernel/debug/displaylcd/trace, one operation per line: the time in nanoseconds, the operation and its data in hexadecimal
+static int trace_show(struct seq_file * m, void * v)
+{
+	struct lcd_trace * t;
+	int x;
+	int y;
+
+	mutex_lock(&lcd_mutex);
+
+	for(x = 0; x < trace_count; x++)
+	{
+		t = &trace[(trace_first + x) % TRACE_ENTRIES];
+		// %*phN prints 64 bytes at most, bigger frames are printed in pieces
+		seq_printf(m, "%llu %s ", t->ns, trace_ops[t->op]);
+		for(y = 0; y < t->len; y += 64)
+			seq_printf(m, "%*phN", min(t->len - y, 64), &t->data[y]);
+		seq_putc(m, '\n');
+	}
+
+	mutex_unlock(&lcd_mutex);
+
+	return 0;
+}
+
+static int trace_open(struct inode * inode, struct file * file)
+{
+	return single_open(file, trace_show, NULL);
+}
+
+// Writing anything to /sys/kernel/debug/displaylcd/trace clears it
+static ssize_t trace_write(struct file * file, const char __user * buffer, size_t len, loff_t * offset)
+{
+	mutex_lock(&lcd_mutex);
+	trace_first = 0;
+	trace_count = 0;
+	mutex_unlock(&lcd_mutex);
+
+	return len;
+}
+
+static const struct file_operations trace_fops = {
+	.open = trace_open,
+	.read = seq_read,
+	.write = trace_write,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+static int u32_cmp(const void * a, const void * b)
+{
+	u32 x = *(const u32 *)a;
+	u32 y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// Prints the distribution of one of the jitter sample sets. The samples are sorted in place
+static void jitter_print(struct seq_file * m, const char * name, u32 * samples, unsigned long total, unsigned int configured)
+{
+	unsigned int n = min_t(unsigned long, total, JITTER_SAMPLES);
+
+	seq_printf(m, "%s: configured %u ns, %lu samples", name, configured, total);
+	if(n == 0)
+	{
+		seq_puts(m, "\n");
+		return;
+	}
+
+	sort(samples, n, sizeof(u32), u32_cmp, NULL);
+	seq_printf(m, " (last %u) min %u p50 %u p90 %u p99 %u p99.9 %u max %u ns\n", n, samples[0], samples[n / 2],
+		samples[n * 90 / 100], samples[n * 99 / 100], samples[n * 999 / 1000], samples[n - 1]);
+}
+
+// Shows the contents of /sys/kernel/debug/displaylcd/jitter. The configured values are the delays in use (see lcd_delays) for the way the
+// bytes are sent (see bulk), the GPIO changes add to them
+static int jitter_show(struct seq_file * m, void * v)
+{
+	static u32 pulse[JITTER_SAMPLES];	// Static, they are too big for the stack. The debugfs files are read with lcd_mutex held
+	static u32 gap[JITTER_SAMPLES];
+	unsigned long npulse;
+	unsigned long ngap;
+
+	mutex_lock(&lcd_mutex);
+
+	memcpy(pulse, jitter_pulse, sizeof(pulse));
+	memcpy(gap, jitter_gap, sizeof(gap));
+	npulse = jitter_npulse;
+	ngap = jitter_ngap;
+
+	jitter_print(m, "pulse", pulse, npulse, bulk ? pulse_ns : setup_ns + hold_ns);
+	jitter_print(m, "gap", gap, ngap, bulk ? bulk_after_ns : after_ns);
+
+	mutex_unlock(&lcd_mutex);
+
+	return 0;
+}
+
+static int jitter_open(struct inode * inode, struct file * file)
+{
+	return single_open(file, jitter_show, NULL);
+}
+
+// Writing anything to /sys/kernel/debug/displaylcd/jitter clears the samples
+static ssize_t jitter_write(struct file * file, const char __user * buffer, size_t len, loff_t * offset)
+{
+	mutex_lock(&lcd_mutex);
+	jitter_npulse = 0;
+	jitter_ngap = 0;
+	mutex_unlock(&lcd_mutex);
+
+	return len;
+}
+
+// Shows the contents of /sys/kernel/debug/displaylcd/faults, the bus errors and how the driver recovered from them
+static int faults_show(struct seq_file * m, void * v)
+{
+	mutex_lock(&lcd_mutex);
+
+	seq_printf(m, "offline: %d\n", offline);
+	seq_printf(m, "faults: %lu\n", faults);
+	seq_printf(m, "retries: %lu\n", retries);
+	seq_printf(m, "reinits: %lu\n", reinits);
+	seq_printf(m, "reinit_failures: %lu\n", reinit_failures);
+	seq_printf(m, "offline_count: %lu\n", offline_count);
+	seq_printf(m, "recoveries: %lu\n", recoveries);
+	seq_printf(m, "recovery_last_us: %llu\n", div_u64(recovery_last_ns, NSEC_PER_USEC));
+	seq_printf(m, "recovery_max_us: %llu\n", div_u64(recovery_max_ns, NSEC_PER_USEC));
+	seq_printf(m, "readback: %d\n", rw_pin >= 0);
+	seq_printf(m, "busy_timeouts: %lu\n", busy_timeouts);
+	seq_printf(m, "ac_mismatches: %lu\n", ac_mismatches);
+	seq_printf(m, "extra_displays: %d\n", nextra);
+	seq_printf(m, "extra_faults: %lu\n", extra_faults);
+
+	mutex_unlock(&lcd_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(faults);
+
+// /sys/kernel/debug/displaylcd/jitter_enable turns the EN pulse measurements on (1) and off (0)
+static int jitter_enable_get(void * data, u64 * val)
+{
+	*val = static_key_enabled(&jitter_key);
+	return 0;
+}
+
+static int jitter_enable_set(void * data, u64 val)
+{
+	if(val)
+		static_branch_enable(&jitter_key);
+	else
+		static_branch_disable(&jitter_key);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(jitter_enable_fops, jitter_enable_get, jitter_enable_set, "%llu\n");
+
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+// /sys/kernel/debug/displaylcd/fail_gpio_enable turns the injection of the faults configured in fail_gpio on (1) and off (0)
+static int fail_gpio_enable_get(void * data, u64 * val)
+{
+	*val = static_key_enabled(&fault_key);
+	return 0;
+}
+
+static int fail_gpio_enable_set(void * data, u64 val)
+{
+	if(val)
+		static_branch_enable(&fault_key);
+	else
+		static_branch_disable(&fault_key);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(fail_gpio_enable_fops, fail_gpio_enable_get, fail_gpio_enable_set, "%llu\n");
+#endif
+
+static const struct file_operations jitter_fops = {
+	.open = jitter_open,
+	.read = seq_read,
+	.write = jitter_write,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+// Every operation that talks to the display starts with lcd_lock and ends with lcd_unlock. They serialize the access to the display,
+// take note of the bus time and wake the programs waiting for the display content to change.
+static int lcd_lock(void)
+{
+	// If the display is already taken by another write, I take note of it before waiting, this means the display is not keeping up
+	if(!mutex_trylock(&lcd_mutex))
+	{
+		if(mutex_lock_interruptible(&lcd_mutex))
+			return -ERESTARTSYS;
+		contended++;
+	}
+	writes++;
+
+	// Take note of the time and the bytes sent before the operation, so the difference can be charged to the process
+	op_start = ktime_get();
+	op_bytes = bus_bytes;
+
+	return 0;
+}
+
+// If the content of the display changed, it goes to the frame history (see lcd_hist_record) and the programs waiting for it are woken.
+// Called with lcd_mutex held
+static void lcd_publish(const struct lcd_anim * owner)
+{
+	if(lcd.dirty)
+	{
+		lcd.dirty = false;
+		shadow_gen++;
+		lcd_hist_record(owner);
+		wake_up_interruptible(&shadow_wait);
+	}
+}
+
+static void lcd_unlock(void)
+{
+	lcd_publish(NULL);
+
+	if(bus_bytes != op_bytes)	// Writes that didn't touch the display (like an invalid position) are not accounted
+	{
+		u64 ns = ktime_to_ns(ktime_sub(ktime_get(), op_start));
+
+		lcd_account(ns, bus_bytes - op_bytes);
+		lcd_busy(ns);
+		bus_ns_total += ns;
+		bus_bytes_total += bus_bytes - op_bytes;
+	}
+
+	mutex_unlock(&lcd_mutex);
+}
+
+// Sends a plan like lcd_run does, in pieces of at most max_hold_us (see its declaration)
+static void lcd_run_bounded(const struct lcd_plan * plan)
+{
+	u64 limit = (u64)READ_ONCE(max_hold_us) * NSEC_PER_USEC;
+	u64 start = ktime_get_ns();
+	u64 now;
+	unsigned int sent = 0;		// Bytes sent since start, the average cost of a byte is taken from them
+	unsigned int x;
+
+	for(x = 0; x < plan->count; x++)
+	{
+		if(plan->ops[x] & PLAN_CHAR)
+			lcd_char(&lcd, plan->ops[x] & 0xFF);
+		else
+			lcd_goto(&lcd, plan->ops[x] & 0x7F);
+		sent++;
+
+		now = ktime_get_ns();
+		if(limit && (x + 1 < plan->count) && (now - start + div_u64(now - start, sent) > limit))	// The next byte would go over the limit
+		{
+			hold_max_ns = max(hold_max_ns, now - start);
+			hold_yields++;
+			cond_resched();
+			start = ktime_get_ns();
+			sent = 0;
+		}
+	}
+
+	hold_max_ns = max(hold_max_ns, ktime_get_ns() - start);
+}
+
+// Plan cache. Programs usually cycle through a few screens, and the animations through a few frames, so the same transitions are planned
+// again and again. The last PLAN_CACHE plans are kept with the hashes (lcd_hash) of the frames they go from and to, and the cursor and
+// entry mode they start with. After a frame is shown the shadow is that frame, so the hash of the shadow is known until the shadow changes
+// some other way (shadow_gen tells), and finding a plan costs a single hash of the new frame, without comparing any frame.
+// In the unlikely case of two transitions with the same hashes, the shadow doesn't match the frame after the plan is run: the entry is
+// dropped and the frame is planned from the shadow, which fixes the display. DISPLAYLCD_IOC_COST doesn't use the cache, the candidate
+// frames it is asked about are often never shown. When the cache is full, the least recently used entry is replaced.
+// /sys/kernel/debug/displaylcd/plancache shows the hit rate
+#define PLAN_CACHE 16
+struct lcd_cached_plan {
+	u64 src;						// lcd_hash of the shadow before the plan
+	u64 dst;						// lcd_hash of the frame shown by the plan
+	unsigned char cursor;			// The cursor before the plan
+	unsigned char entry;			// The Entry Mode Set, the plans of right to left are different
+	u64 used;						// When the entry was last used, in lookups (0 when the entry is empty)
+	struct lcd_plan plan;
+};
+static struct lcd_cached_plan plan_cache[PLAN_CACHE];
+static u64 shadow_hash;					// lcd_hash of the shadow...
+static u64 shadow_hash_gen = U64_MAX;	// ...when shadow_gen had this value (none when the module is loaded)
+static u64 cache_lookups = 0;
+static u64 cache_hits = 0;
+static u64 cache_evictions = 0;
+static u64 cache_collisions = 0;		// Hits whose plan didn't show the frame
+
+// Empties the plan cache, the plans of another geometry don't apply. lcd_mutex must be held
+static void lcd_cache_reset(void)
+{
+	memset(plan_cache, 0, sizeof(plan_cache));
+	shadow_hash_gen = U64_MAX;
+}
+
+// Shows a frame like lcd_plan and lcd_run_bounded do, with the plan from the cache when the transition was seen before. scratch is where
+// a new plan is built. lcd_mutex must be held
+static void lcd_show_cached(const unsigned char * frame, struct lcd_plan * scratch)
+{
+	int cells = lcd_cells(&lcd);
+	u64 dst = lcd_hash(frame, cells);
+	struct lcd_cached_plan * victim = &plan_cache[0];
+	struct lcd_cached_plan * c;
+	int x;
+
+	if((shadow_hash_gen != shadow_gen) || lcd.dirty)		// The shadow changed since the last frame shown
+	{
+		shadow_hash = lcd_hash(lcd.shadow, cells);
+		shadow_hash_gen = shadow_gen;
+	}
+
+	cache_lookups++;
+	for(x = 0; x < PLAN_CACHE; x++)
+	{
+		c = &plan_cache[x];
+		if(c->used && (c->src == shadow_hash) && (c->dst == dst) && (c->cursor == lcd.cursor) && (c->entry == lcd.entry))
+			break;
+		if(c->used < victim->used)
+			victim = c;
+	}
+
+	if(x < PLAN_CACHE)
+	{
+		c->used = cache_lookups;
+		cache_hits++;
+		lcd_run_bounded(&c->plan);
+		if(memcmp(lcd.shadow, frame, cells))
+		{
+			cache_collisions++;
+			c->used = 0;
+			lcd_plan(&lcd, frame, scratch);
+			lcd_run_bounded(scratch);
+		}
+	}
+	else
+	{
+		lcd_plan(&lcd, frame, scratch);
+		if(scratch->count)		// When the frame is already shown there's nothing worth keeping
+		{
+			if(victim->used)
+				cache_evictions++;
+			victim->src = shadow_hash;
+			victim->dst = dst;
+			victim->cursor = lcd.cursor;
+			victim->entry = lcd.entry;
+			victim->used = cache_lookups;
+			memcpy(&victim->plan, scratch, sizeof(*scratch));
+		}
+		lcd_run_bounded(scratch);
+	}
+
+	// The shadow is the frame now, and lcd_unlock publishes it as the next generation if it changed
+	shadow_hash = dst;
+	shadow_hash_gen = shadow_gen + (lcd.dirty ? 1 : 0);
+}
+
+// Shows the contents of /sys/kernel/debug/displaylcd/plancache
+static int plancache_show(struct seq_file * m, void * v)
+{
+	int used = 0;
+	int x;
+
+	mutex_lock(&lcd_mutex);
+
+	for(x = 0; x < PLAN_CACHE; x++)
+		if(plan_cache[x].used)
+			used++;
+	seq_printf(m, "entries: %d/%d\n", used, PLAN_CACHE);
+	seq_printf(m, "lookups: %llu\n", cache_lookups);
+	seq_printf(m, "hits: %llu\n", cache_hits);
+	seq_printf(m, "hit_rate: %llu%%\n", cache_lookups ? div64_u64(cache_hits * 100, cache_lookups) : 0);
+	seq_printf(m, "evictions: %llu\n", cache_evictions);
+	seq_printf(m, "collisions: %llu\n", cache_collisions);
+
+	mutex_unlock(&lcd_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(plancache);
+
+// DISPLAYLCD_IOC_COST: tells how many bytes and how much time the candidate frame would take to be shown
+static long lcd_ioctl_cost(void __user * arg)
+{
+	struct displaylcd_cost cost;
+	struct lcd_plan plan;
+	u64 byte_ns;
+
+	if(copy_from_user(&cost, arg, sizeof(cost)))
+		return -EFAULT;
+
+	mutex_lock(&lcd_mutex);
+	lcd_plan(&lcd, cost.frame, &plan);
+	cost.commands = plan.commands;
+	cost.chars = plan.chars;
+	// Before anything is measured, a byte takes the timing profile delay plus 11 GPIO changes (see BYTE_NS)
+	byte_ns = bus_bytes_total ? div64_u64(bus_ns_total, bus_bytes_total) : timing->cmd_us * NSEC_PER_USEC + 11 * 500;
+	mutex_unlock(&lcd_mutex);
+
+	cost.cgram_writes = 0;	// The glyphs go to the CGRAM when DISPLAYLCD_IOC_CHARMAP loads them (and after a recovery), a frame only uses them
+	cost.predicted_us = div_u64((cost.commands + cost.chars) * byte_ns, NSEC_PER_USEC);
+
+	if(copy_to_user(arg, &cost, sizeof(cost)))
+		return -EFAULT;
+
+	return 0;
+}
+
+// DISPLAYLCD_IOC_SHOW: shows a whole frame, sending only the cells that changed
+static long lcd_ioctl_show(struct file * filp, void __user * arg)
+{
+	struct displaylcd_frame frame;
+	struct lcd_plan plan;
+
+	if(!(filp->f_mode & FMODE_WRITE))	// Changing the display is only allowed to the program that opened it for writing
+		return -EBADF;
+
+	if(copy_from_user(&frame, arg, sizeof(frame)))
+		return -EFAULT;
+
+	if(lcd_lock())
+		return -ERESTARTSYS;
+
+	lcd_trace(TRACE_SHOW, frame.frame, lcd_cells(&lcd));
+	lcd_show_cached(frame.frame, &plan);
+
+	lcd_unlock();
+
+	return 0;
+}
+
+// Returns the state of display d (0 is the one of /dev/displaylcd, the others come from extra_en)
+static struct lcd_core * lcd_display(int d)
+{
+	return d ? &others[d - 1] : &lcd;
+}
+
+// True when two displays have the same geometry and show the same thing with the cursor in the same place, so any frame has the same plan on both
+static bool lcd_same(const struct lcd_core * a, const struct lcd_core * b)
+{
+	return (a->rows == b->rows) && (a->cols == b->cols) && !memcmp(a->offsets, b->offsets, sizeof(a->offsets)) &&
+		(a->cursor == b->cursor) && (a->entry == b->entry) && !memcmp(a->shadow, b->shadow, lcd_cells(a));
+}
+
+// DISPLAYLCD_IOC_BATCH: shows a frame on each display of the mask. The displays that would get the same bytes are grouped, and the plan of each
+// group is sent by lcd_batch_send, pulsing the EN pins of the whole group
+static long lcd_ioctl_batch(struct file * filp, void __user * arg)
+{
+	static struct displaylcd_batch batch;		// These are too big for the kernel stack, and they are only used with the display locked
+	static struct lcd_plan plans[DISPLAYLCD_MAX_DISPLAYS];
+	unsigned long masks[DISPLAYLCD_MAX_DISPLAYS] = { 0 };	// The EN pins of the group of each plan, 0 for the displays that are not planned
+	int leader[DISPLAYLCD_MAX_DISPLAYS];					// The display whose plan is sent to each display
+	long ret = 0;
+	int d;
+	int g;
+
+	if(!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	if(lcd_lock())
+		return -ERESTARTSYS;
+
+	if(copy_from_user(&batch, arg, sizeof(batch)))
+	{
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if(batch.mask >> (1 + nextra))		// A display that was not given to the driver
+	{
+		ret = -EINVAL;
+		goto out;
+	}
+
+	batch.mirrored = 0;
+	for(d = 0; d <= nextra; d++)
+	{
+		if(!(batch.mask & (1 << d)))
+			continue;
+
+		// A display that is like one planned before and gets the same frame joins its group, the plan would be the same
+		for(g = 0; g < d; g++)
+			if(masks[g] && lcd_same(lcd_display(g), lcd_display(d)) && !memcmp(batch.frames[g], batch.frames[d], lcd_cells(lcd_display(d))))
+				break;
+
+		if(g < d)
+		{
+			masks[g] |= EN_BIT(d);
+			batch.mirrored |= 1 << d;
+		}
+		else
+		{
+			lcd_plan(lcd_display(d), batch.frames[d], &plans[d]);
+			masks[d] = EN_BIT(d);
+		}
+		leader[d] = g;
+	}
+
+	// The shadows are updated before the bytes are sent, so a display that fails is redrawn with the new frame
+	for(d = 0; d <= nextra; d++)
+		if(batch.mask & (1 << d))
+			lcd_apply(lcd_display(d), &plans[leader[d]]);
+	for(d = 1; d <= nextra; d++)
+		others[d - 1].dirty = false;	// Only display 0 can be read, history and poll
+	if(batch.mask & 1)
+		lcd_trace(TRACE_SHOW, batch.frames[0], lcd_cells(&lcd));
+	if(offline)		// Like the other writes, only the shadow is kept up to date
+		masks[0] &= ~EN_BIT(0);
+
+	if(lcd_batch_send(plans, masks))
+		ret = -EIO;
+
+	if(copy_to_user(&((struct displaylcd_batch __user *)arg)->mirrored, &batch.mirrored, sizeof(batch.mirrored)))
+		ret = -EFAULT;
+
+out:
+	lcd_unlock();
+
+	return ret;
+}
+
+// Returns the log line of the given age (0 is the newest)
+static char * lcd_log_line(unsigned int age)
+{
+	return &log_ring[((log_newest + log_depth - age) % log_depth) * MAX_CELLS];
+}
+
+// The view can go back until the oldest line is in the first row
+static unsigned int lcd_log_max_scroll(void)
+{
+	return log_lines > lcd.rows ? log_lines - lcd.rows : 0;
+}
+
+// Shows the log lines in the view, the oldest one in the first row. Only the cells that changed are sent
+static void lcd_log_show(void)
+{
+	unsigned char frame[MAX_CELLS];
+	struct lcd_plan plan;
+	unsigned int shown = min_t(unsigned int, log_lines, lcd.rows);
+	unsigned int r;
+
+	log_scroll = min(log_scroll, lcd_log_max_scroll());		// The geometry may have changed
+	memset(frame, ' ', sizeof(frame));
+	for(r = 0; r < shown; r++)
+		memcpy(&frame[r * lcd.cols], lcd_log_line(log_scroll + shown - 1 - r), lcd.cols);
+
+	lcd_trace(TRACE_SHOW, frame, lcd_cells(&lcd));
+	lcd_plan(&lcd, frame, &plan);
+	lcd_run_bounded(&plan);
+}
+
+// Appends the characters written to /dev/displaylcd_log to the log
+static void lcd_log_append(const char * buffer, size_t len)
+{
+	size_t x;
+
+	for(x = 0; x < len; x++)
+	{
+		if(buffer[x] == '\r')
+			continue;
+
+		if(log_newline)
+		{
+			log_newest = (log_newest + 1) % log_depth;
+			memset(lcd_log_line(0), ' ', MAX_CELLS);
+			log_lines = min(log_lines + 1, log_depth);
+			log_col = 0;
+			log_newline = false;
+
+			// A view scrolled back stays on the same lines, unless they are gone
+			if(log_scroll)
+				log_scroll = min(log_scroll + 1, lcd_log_max_scroll());
+		}
+
+		if(buffer[x] == '\n')
+			log_newline = true;
+		else if(log_col < MAX_CELLS)
+			lcd_log_line(0)[log_col++] = buffer[x];
+	}
+}
+
+// A write to /dev/displaylcd_log. It can be longer than the writes to the other files, it is copied in pieces
+static ssize_t lcd_log_write(const char __user * buffer, size_t len)
+{
+	char kbuf[64];
+	size_t done;
+	size_t n;
+
+	if(!log_ring)
+		return -ENODEV;
+
+	if(lcd_lock())
+		return -ERESTARTSYS;
+
+	for(done = 0; done < len; done += n)
+	{
+		n = min(len - done, sizeof(kbuf));
+		if(copy_from_user(kbuf, buffer + done, n))
+			break;
+		lcd_log_append(kbuf, n);
+	}
+	if(done)
+		lcd_log_show();
+
+	lcd_unlock();
+
+	return done ? done : -EFAULT;
+}
+
+// DISPLAYLCD_IOC_SCROLL: moves the log view. Scrolling changes what the display shows, so like the writes it needs the log file opened for writing
+static long lcd_ioctl_scroll(struct file * filp, void __user * arg)
+{
+	struct lcd_file * lf = filp->private_data;
+	struct displaylcd_scroll scroll;
+	long target;
+
+	if(lf->minor != LOG_MINOR)
+		return -ENOTTY;
+	if(!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+	if(!log_ring)
+		return -ENODEV;
+
+	if(copy_from_user(&scroll, arg, sizeof(scroll)))
+		return -EFAULT;
+
+	if(lcd_lock())
+		return -ERESTARTSYS;
+
+	target = (long)log_scroll + scroll.lines;
+	log_scroll = clamp_t(long, target, 0, lcd_log_max_scroll());
+	lcd_log_show();
+
+	scroll.offset = log_scroll;
+	scroll.count = log_lines;
+
+	lcd_unlock();
+
+	if(copy_to_user(arg, &scroll, sizeof(scroll)))
+		return -EFAULT;
+
+	return 0;
+}
+
+// Shows the current frame of every animation over the shadow, and schedules anim_work for the next step due
+static void lcd_anim_show(void)
+{
+	unsigned char frame[MAX_CELLS];
+	struct lcd_plan plan;
+	unsigned long next = 0;
+	bool any = false;
+	int x;
+
+	memcpy(frame, lcd.shadow, sizeof(frame));
+	for(x = 0; x < DISPLAYLCD_MAX_ANIMS; x++)
+	{
+		if(!anims[x].active)
+			continue;
+		if(anims[x].cell + anims[x].width > lcd_cells(&lcd))	// The display became smaller
+		{
+			anims[x].active = false;
+			continue;
+		}
+		memcpy(&frame[anims[x].cell], anims[x].frames[anims[x].step], anims[x].width);
+		if(!any || time_before(anims[x].next, next))
+			next = anims[x].next;
+		any = true;
+	}
+
+	lcd_trace(TRACE_SHOW, frame, lcd_cells(&lcd));
+	lcd_show_cached(frame, &plan);
+
+	if(any)
+		mod_delayed_work(system_wq, &anim_work, time_after(next, jiffies) ? next - jiffies : 0);
+}
+
+// The animations that are due go to their next frame
+// The animations are not written by any program, so the work takes the mutex itself instead of lcd_lock: it is not counted in writes
+// and contended, and no process is charged for its bus time. The frame history shows the steps under the process that started the
+// animation (the first one that stepped), not the kworker
+static void lcd_anim_step(struct work_struct * work)
+{
+	const struct lcd_anim * owner = NULL;
+	unsigned long bytes;
+	ktime_t start;
+	u64 ns;
+	int x;
+
+	mutex_lock(&lcd_mutex);
+	start = ktime_get();
+	bytes = bus_bytes;
+
+	for(x = 0; x < DISPLAYLCD_MAX_ANIMS; x++)
+	{
+		if(!anims[x].active || time_before(jiffies, anims[x].next))
+			continue;
+
+		anims[x].step = (anims[x].step + 1) % anims[x].nframes;
+		anims[x].next += anims[x].period;
+		if(time_after_eq(jiffies, anims[x].next))	// The work ran late, the steps that were missed are skipped
+			anims[x].next = jiffies + anims[x].period;
+		anim_steps++;
+		if(!owner)
+			owner = &anims[x];
+	}
+	lcd_anim_show();
+	lcd_publish(owner);
+
+	// The bus was busy all the same, so the time still counts in the utilization and in the average cost of a byte
+	if(bus_bytes != bytes)
+	{
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		lcd_busy(ns);
+		bus_ns_total += ns;
+		bus_bytes_total += bus_bytes - bytes;
+	}
+
+	mutex_unlock(&lcd_mutex);
+}
+
+// DISPLAYLCD_IOC_ANIMATE: starts (or stops, with no frames) the animation of a region. The first frame is shown at once
+static long lcd_ioctl_animate(struct file * filp, void __user * arg)
+{
+	struct displaylcd_anim * req;
+	struct lcd_anim * a;
+	long ret = 0;
+
+	if(!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL);	// Too big for the kernel stack
+	if(!req)
+		return -ENOMEM;
+	if(copy_from_user(req, arg, sizeof(*req)))
+	{
+		kfree(req);
+		return -EFAULT;
+	}
+
+	if(lcd_lock())
+	{
+		kfree(req);
+		return -ERESTARTSYS;
+	}
+
+	if((req->slot >= DISPLAYLCD_MAX_ANIMS) || (req->nframes > DISPLAYLCD_ANIM_FRAMES) ||
+		(req->nframes && (!req->width || (req->cell + req->width > lcd_cells(&lcd)) || (req->period_ms < ANIM_MIN_MS))))
+	{
+		ret = -EINVAL;
+		goto out;
+	}
+
+	// A region that stops animating keeps the frame it was showing
+	a = &anims[req->slot];
+	a->active = false;
+	if(req->nframes)
+	{
+		a->cell = req->cell;
+		a->width = req->width;
+		a->nframes = req->nframes;
+		a->step = 0;
+		a->period = max(msecs_to_jiffies(req->period_ms), 1UL);
+		a->next = jiffies + a->period;
+		a->pid = task_tgid_nr(current);
+		get_task_comm(a->comm, current);
+		memcpy(a->frames, req->frames, sizeof(a->frames));
+		a->active = true;
+		lcd_anim_show();
+	}
+
+out:
+	lcd_unlock();
+	kfree(req);
+
+	return ret;
+}
+
+// DISPLAYLCD_IOC_MODE: shows or hides the cursor, makes it blink, turns the display off and on, and chooses the direction of the writes
+static long lcd_ioctl_mode(struct file * filp, void __user * arg)
+{
+	struct displaylcd_mode mode;
+	unsigned char control = LCD_CONTROL;
+	unsigned char entry = LCD_ENTRY;
+	char commands[2];
+
+	if(!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	if(copy_from_user(&mode, arg, sizeof(mode)))
+		return -EFAULT;
+
+	if(mode.flags & ~(DISPLAYLCD_CURSOR | DISPLAYLCD_BLINK | DISPLAYLCD_RTL | DISPLAYLCD_OFF))
+		return -EINVAL;
+
+	if(!(mode.flags & DISPLAYLCD_OFF))
+		control |= LCD_CONTROL_DISPLAY;
+	if(mode.flags & DISPLAYLCD_CURSOR)
+		control |= LCD_CONTROL_CURSOR;
+	if(mode.flags & DISPLAYLCD_BLINK)
+		control |= LCD_CONTROL_BLINK;
+	if(!(mode.flags & DISPLAYLCD_RTL))
+		entry |= LCD_ENTRY_INC;
+
+	if(lcd_lock())
+		return -ERESTARTSYS;
+
+	commands[0] = control;
+	commands[1] = entry;
+	lcd_trace(TRACE_MODE, commands, sizeof(commands));
+	lcd_mode(&lcd, control, entry);
+
+	lcd_unlock();
+
+	return 0;
+}
+
+// DISPLAYLCD_IOC_CHARMAP: loads a translation table and the custom characters
+static long lcd_ioctl_charmap(struct file * filp, void __user * arg)
+{
+	struct displaylcd_charmap * req;
+	long ret = 0;
+	unsigned int x;
+
+	if(!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL);	// Too big for the kernel stack
+	if(!req)
+		return -ENOMEM;
+	if(copy_from_user(req, arg, sizeof(*req)))
+	{
+		kfree(req);
+		return -EFAULT;
+	}
+
+	if((req->count > DISPLAYLCD_CHARMAP_MAX) || (req->glyphs >> DISPLAYLCD_GLYPHS))
+	{
+		kfree(req);
+		return -EINVAL;
+	}
+
+	if(lcd_lock())
+	{
+		kfree(req);
+		return -ERESTARTSYS;
+	}
+
+	charmap_next.count = req->count;
+	for(x = 0; x < req->count; x++)
+	{
+		charmap_next.entries[x].codepoint = req->entries[x].codepoint;
+		charmap_next.entries[x].code = req->entries[x].code;
+	}
+	if(lcd_charmap_build(&charmap_next))
+	{
+		ret = -EINVAL;
+		goto out;
+	}
+	charmap = charmap_next;
+	charmap_on = charmap.count > 0;
+
+	for(x = 0; x < DISPLAYLCD_GLYPHS; x++)
+	{
+		if(!(req->glyphs & (1 << x)))
+			continue;
+		memcpy(glyphs[x], req->glyph[x], sizeof(glyphs[x]));
+		lcd_glyph(&lcd, x, glyphs[x]);
+	}
+	glyph_mask |= req->glyphs;
+
+out:
+	lcd_unlock();
+	kfree(req);
+
+	return ret;
+}
+
+static long device_ioctl(struct file * filp, unsigned int cmd, unsigned long arg)
+{
+	switch(cmd)
+	{
+		case DISPLAYLCD_IOC_COST:
+			return lcd_ioctl_cost((void __user *)arg);
+
+		case DISPLAYLCD_IOC_SHOW:
+			return lcd_ioctl_show(filp, (void __user *)arg);
+
+		case DISPLAYLCD_IOC_BATCH:
+			return lcd_ioctl_batch(filp, (void __user *)arg);
+
+		case DISPLAYLCD_IOC_SCROLL:
+			return lcd_ioctl_scroll(filp, (void __user *)arg);
+
+		case DISPLAYLCD_IOC_ANIMATE:
+			return lcd_ioctl_animate(filp, (void __user *)arg);
+
+		case DISPLAYLCD_IOC_MODE:
+			return lcd_ioctl_mode(filp, (void __user *)arg);
+
+		case DISPLAYLCD_IOC_CHARMAP:
+			return lcd_ioctl_charmap(filp, (void __user *)arg);
+	}
+
+	return -ENOTTY;
+}
+
+static ssize_t device_write(struct file * filp, const char * buffer, size_t len, loff_t * offset)
+{
+	struct lcd_file * lf = filp->private_data;
+	char kbuf[4 * 30 + 1];	// With a translation table loaded, each of the 30 characters can take up to 4 bytes of UTF-8
+	size_t max = 30;
+	size_t n = len;
+
+	if(lf->minor == LOG_MINOR)
+		return lcd_log_write(buffer, len);
+
+	// The 30 characters are checked again after the translation, under the mutex (the table can change until then)
+	if((lf->minor == 0) && READ_ONCE(charmap_on))
+		max = 4 * 30;
+
+	if(len > max)	// I will check if the message is bigger than the buffer, if so I will ignore it and pintk an warning message (it only makes sense receiving 17 characters at max)
+	{
+		printk(KERN_INFO "LCD Display Driver: Message too long (ignored) with %zu chars\n", len);
+		mutex_lock(&lcd_mutex);
+		dropped++;
+		mutex_unlock(&lcd_mutex);
+		return len;
+	}
+
+	// The buffer belongs to the user program, so I must copy it to the kernel memory before looking at it
+	if(copy_from_user(kbuf, buffer, len))
+		return -EFAULT;
+
+	if(lcd_lock())
+		return -ERESTARTSYS;
+
+	// The trace keeps what the program wrote, not the codes, so a replay is translated once, by the driver that receives it
+	lcd_trace(lf->minor, kbuf, len);
+
+	// The text is translated in place, the codes are never more than the bytes of the text
+	if((lf->minor == 0) && charmap_on)
+	{
+		n = lcd_translate(&charmap, kbuf, len, (unsigned char *)kbuf);
+		if(n > 30)
+		{
+			printk(KERN_INFO "LCD Display Driver: Message too long (ignored) with %zu chars\n", n);
+			dropped++;
+			lcd_unlock();
+			return len;
+		}
+	}
+
+	lcd_handle_write(&lcd, lf->minor, kbuf, n);
+
+	lcd_unlock();
+
+	return len;
+}
+
+// This function changes one of the display pins (RS, EN, DB4...). It returns an error when a fault is injected
+static int lcd_gpio_set(int pin, int value)
+{
+	if(lcd_should_fail())
+		return -EIO;
+
+	if(pin == RS)
+		rs_level = value ? 1 : 0;
+	gpio_set_value(pins[pin].gpio, value);
+	return 0;
+}
+
+// Changes the EN pins of the displays being written (see en_mask)
+static int lcd_en(int value)
+{
+	int err = 0;
+	int x;
+
+	if(en_mask == EN_BIT(0))
+		return lcd_gpio_set(EN, value);
+
+	for_each_set_bit(x, &en_mask, ENC_PINS + nextra)
+	{
+		if(lcd_should_fail())
+			err = -EIO;
+		else
+			gpiod_set_raw_value(descs[x], value);
+	}
+	return err;
+}
+
+// This function changes all the display pins at once, to one of the states of lcd_encoding (bit x is pins[x]).
+// The EN bit of the state stands for the EN pins of the displays being written
+static int lcd_gpio_state(unsigned long state)
+{
+	if(lcd_should_fail())
+		return -EIO;
+
+	if(state & EN_BIT(0))
+		state = (state & ~EN_BIT(0)) | en_mask;
+	return gpiod_set_raw_array_value(ENC_PINS + nextra, descs, NULL, &state);
+}
+
+// The EN pin went high: returns the time, to measure the pulse (or 0 when the timing is not measured, see jitter_enable)
+static u64 lcd_jitter_high(void)
+{
+	u64 high;
+
+	if(!static_branch_unlikely(&jitter_key))
+		return 0;
+
+	high = ktime_get_ns();
+	if(jitter_second && jitter_low)
+		jitter_gap[jitter_ngap++ % JITTER_SAMPLES] = high - jitter_low;
+	return high;
+}
+
+// The EN pin went low, the pulse that started at "high" is over
+static void lcd_jitter_low(u64 high)
+{
+	if(!static_branch_unlikely(&jitter_key))
+		return;
+
+	jitter_low = ktime_get_ns();
+	if(high)
+		jitter_pulse[jitter_npulse++ % JITTER_SAMPLES] = jitter_low - high;
+}
+
+// This function writes a single nibble to the display, by looking at the 4 least significant bits of "nibble"
+// The least significatn bit is written to the pin DB4, the next to DB5, and so on.
+int lcd_nibble(unsigned char nibble)
+{
+	u64 high;
+	int err = 0;
+
+	// Before entering this function, the RS pin must be set or clear from the calling function, signaling
+	// if the next write is for a character or a command. This function does no change the RS pin state
+	err |= lcd_en(1);	// Put the EN pin in high logic level, as defined on the HD44780 datasheet (page 58, figure 25)
+	high = lcd_jitter_high();
+	
+	// Ensures a minumum delay of 150ns before setting the data pins, according to the datasheet. The measured time of GPIO change on a Raspberry Pi 3 is 500ns,
+	// so usually this delay is skipped (see compensate)
+	if(setup_ns)
+		ndelay(setup_ns);
+	
+	// Check every bit from the nibble, and set or clear the data pin accordingly
+	err |= nibble & 0x01 ? lcd_gpio_set(DB4, 1) : lcd_gpio_set(DB4, 0);
+	err |= nibble & 0x02 ? lcd_gpio_set(DB5, 1) : lcd_gpio_set(DB5, 0);
+	err |= nibble & 0x04 ? lcd_gpio_set(DB6, 1) : lcd_gpio_set(DB6, 0);
+	err |= nibble & 0x08 ? lcd_gpio_set(DB7, 1) : lcd_gpio_set(DB7, 0);
+	
+	if(hold_ns)
+		ndelay(hold_ns);
+	
+	err |= lcd_en(0);	// By changing the EN pin to low state, effectively writes the data present in the data lines to the display
+	lcd_jitter_low(high);
+	
+	if(after_ns)
+		ndelay(after_ns);
+
+	return err ? -EIO : 0;
+}
+
+// Reads the busy flag and the address counter (HD44780 datasheet, page 24). Returns them as BAAA.AAAA (B is the busy flag), or an error.
+// The data pins are inputs only during the read, when the display drives them; and RS is left high, like lcd_byte does
+static int lcd_read_status(void)
+{
+	int status = 0;
+	int err = 0;
+	int x;
+
+	for(x = DB4; x <= DB7; x++)
+		gpio_direction_input(pins[x].gpio);
+	err |= lcd_gpio_set(RS, 0);
+	gpio_set_value(rw_pin, 1);
+	ndelay(EN_SETUP_NS);
+
+	// In 4 bits mode the register is read in two nibbles, the most significant first. The data is valid 360ns after EN goes high
+	for(x = 0; x < 2; x++)
+	{
+		err |= lcd_gpio_set(EN, 1);
+		ndelay(360);
+		status = (status << 4) | gpio_get_value(pins[DB7].gpio) << 3 | gpio_get_value(pins[DB6].gpio) << 2 |
+			gpio_get_value(pins[DB5].gpio) << 1 | gpio_get_value(pins[DB4].gpio);
+		err |= lcd_gpio_set(EN, 0);
+		ndelay(EN_HOLD_NS + EN_AFTER_NS);
+	}
+
+	gpio_set_value(rw_pin, 0);
+	for(x = DB4; x <= DB7; x++)
+		gpio_direction_output(pins[x].gpio, 0);
+	err |= lcd_gpio_set(RS, 1);
+
+	return err ? -EIO : status;
+}
+
+// After a byte is sent, waits until the display is not busy anymore and checks if the address counter is where it should be.
+// A disconnected display never answers (the busy flag stays up or the address counter is garbage), so this is how it is detected
+static int lcd_check(void)
+{
+	u64 deadline = ktime_get_ns() + BUSY_TIMEOUT_NS;
+	int status;
+
+	if(!static_branch_unlikely(&readback_key))		// There's no way to read the display, so it is assumed to be fine
+		return 0;
+
+	do
+	{
+		status = lcd_read_status();
+		if(status < 0)
+			return status;
+		if(!(status & 0x80))
+		{
+			if((ac >= 0) && (status != ac))
+			{
+				ac_mismatches++;
+				ac = -1;	// The display is in an unknown state, until it is initialized or the address is set again
+				return -EIO;
+			}
+			return 0;
+		}
+		udelay(1);
+	} while(ktime_get_ns() < deadline);
+
+	busy_timeouts++;
+	return -ETIMEDOUT;
+}
+
+// This function sends a command (rs == 0) or a character (rs == 1) to the display, returning an error if a pin couldn't be changed
+// or if the display didn't answer as expected
+static int lcd_raw_write(unsigned char byte, int rs)
+{
+	int err = 0;
+
+	if(!rs)
+		err |= lcd_gpio_set(RS, 0);	// I must put the RS pin low, because it is (probably) in high state, and the next byte is a command
+
+	err |= lcd_byte(byte);
+
+	// The Clear Display (0x01) and Return Home (0x02 or 0x03) commands take much longer than the others
+	if(!rs && (byte <= 0x03))
+		mdelay(timing->clear_ms);		// I give here 2ms to the command be executed by the display, which is more than enough (the datasheet specifies 1.52ms)
+
+	// The displays of extra_en can't be read, their address counters are followed by their cores only
+	if(en_mask != EN_BIT(0))
+		return err ? -EIO : 0;
+
+	// Follow the address counter like the display does: characters move it to the next address, Set DDRAM Address, Clear Display and
+	// Return Home set it, Set CGRAM Address and Cursor Shift move it somewhere this function doesn't follow, and the other commands don't change it
+	if(rs)
+		ac = ac < 0 ? -1 : lcd_step(&lcd, ac);
+	else if(byte & 0x80)
+		ac = byte & 0x7F;
+	else if(byte <= 0x03)
+		ac = 0;
+	else if((byte & 0x40) || ((byte & 0xF0) == 0x10))
+		ac = -1;
+
+	if(!err)
+		err = lcd_check();
+
+	return err ? -EIO : 0;
+}
+
+// Clears the display being written (see en_mask) and draws the shadow of its core, leaving the cursor where the core expects it.
+// After the Clear Display the display shows only spaces, so the redraw is planned from a blank display and only the other characters are sent
+static int lcd_redraw(const struct lcd_core * core)
+{
+	struct lcd_core blank = *core;
+	struct lcd_plan plan;
+	unsigned int x;
+	int err;
+
+	// The initialization leaves the display on, without cursor and writing from left to right, and the Clear Display sets left to right again
+	err = lcd_raw_write(0x01, 0);
+	err |= lcd_raw_write(core->control, 0);
+	err |= lcd_raw_write(core->entry, 0);
+	blank.cursor = 0;
+
+	// Data pins that are not connected to anything read as all zeros (or all ones, which is busy forever). The address counter after a
+	// Clear Display is zero too, so an address with both ones and zeros is set and read back, to be sure there's a display answering
+	if((rw_pin >= 0) && (en_mask == EN_BIT(0)))
+	{
+		err |= lcd_raw_write(0x80 | 0x55, 0);
+		blank.cursor = 0x55;
+	}
+
+	memset(blank.shadow, ' ', sizeof(blank.shadow));
+	lcd_plan(&blank, core->shadow, &plan);
+	for(x = 0; (x < plan.count) && !err; x++)
+		err |= lcd_raw_write(plan.ops[x] & 0xFF, plan.ops[x] & PLAN_CHAR ? 1 : 0);
+
+	err |= lcd_raw_write(0x80 | core->cursor, 0);
+
+	return err ? -EIO : 0;
+}
+
+// Loads the glyphs of the translation table in a display that was initialized
+static int lcd_load_glyphs(void)
+{
+	int err = 0;
+	int x;
+	int y;
+
+	for(x = 0; x < DISPLAYLCD_GLYPHS; x++)
+	{
+		if(!(glyph_mask & (1 << x)))
+			continue;
+		err |= lcd_raw_write(0x40 | x << 3, 0);
+		for(y = 0; y < 8; y++)
+			err |= lcd_raw_write(glyphs[x][y] & 0x1F, 1);
+	}
+	return err;
+}
+
+// Initializes the display again and redraws it from the shadow
+static int lcd_reinit(void)
+{
+	if(lcd_hw_init() || lcd_load_glyphs() || lcd_redraw(&lcd))
+	{
+		reinit_failures++;
+		return -EIO;
+	}
+	return 0;
+}
+
+// The error episode is over, take note of how long it took
+static void lcd_recovered(void)
+{
+	recovery_last_ns = ktime_get_ns() - fault_start;
+	recovery_max_ns = max(recovery_max_ns, recovery_last_ns);
+	recoveries++;
+	fault_start = 0;
+}
+
+static void lcd_set_offline(void)
+{
+	if(!fault_start)
+		fault_start = ktime_get_ns();
+	offline = true;
+	offline_count++;
+	printk(KERN_WARNING "LCD Display Driver: the display is not answering, it is offline\n");
+	schedule_delayed_work(&probe_work, PROBE_INTERVAL);
+}
+
+// While the display is offline, this work tries to initialize it every PROBE_INTERVAL. When it works, the display shows the shadow again
+static void lcd_probe(struct work_struct * work)
+{
+	mutex_lock(&lcd_mutex);
+
+	reinits++;
+	if(lcd_reinit() == 0)
+	{
+		offline = false;
+		lcd_recovered();
+		printk(KERN_INFO "LCD Display Driver: the display is back online\n");
+	}
+	else
+		schedule_delayed_work(&probe_work, PROBE_INTERVAL);
+
+	mutex_unlock(&lcd_mutex);
+}
+
+// Initializes the displays of extra_en whose EN pins are in "bits" again, and redraws them from their shadows
+static void lcd_extra_redraw(unsigned long bits)
+{
+	int d;
+
+	en_mask = bits;
+	lcd_hw_init();
+	for(d = 1; d <= nextra; d++)
+	{
+		if(!(bits & EN_BIT(d)))
+			continue;
+		en_mask = EN_BIT(d);
+		if(lcd_redraw(&others[d - 1]))
+			extra_faults++;
+	}
+	en_mask = EN_BIT(0);
+}
+
+// Sends a byte to one of the displays of extra_en. They can't be read, so there's no way to know if they are there, the byte is only
+// sent again when a pin couldn't be changed
+static void lcd_extra_write(int display, unsigned char byte, int rs)
+{
+	int x;
+
+	en_mask = EN_BIT(display);
+	for(x = 0; x <= BYTE_RETRIES; x++)
+	{
+		if(lcd_raw_write(byte, rs) == 0)
+			break;
+		extra_faults++;
+	}
+	en_mask = EN_BIT(0);
+}
+
+// This function is the bus of the core (see displaylcd_core.h). It sends a command (rs == 0) or a character (rs == 1) to the display,
+// recovering from errors as explained where fail_gpio is declared. The cores of the displays of extra_en have their number in priv
+void lcd_gpio_write(void * priv, unsigned char byte, int rs)
+{
+	int cg = cgaddr;	// Where the byte goes
+	int x;
+
+	if(priv)
+	{
+		lcd_extra_write((long)priv, byte, rs);
+		return;
+	}
+
+	// The CGRAM address is followed even when the byte can't be sent, like the core follows the cursor
+	if(rs)
+		cgaddr = cgaddr < 0 ? -1 : (cgaddr + (lcd.entry & LCD_ENTRY_INC ? 1 : -1)) & 0x3F;
+	else if((byte & 0x80) || (byte <= 0x03))
+		cgaddr = -1;
+	else if(byte & 0x40)
+		cgaddr = byte & 0x3F;
+
+	if(offline)		// Only the shadow is kept up to date until the display comes back
+		return;
+
+	for(x = 0; x <= BYTE_RETRIES; x++)
+	{
+		if(lcd_raw_write(byte, rs) == 0)
+		{
+			if(fault_start)
+				lcd_recovered();
+			return;
+		}
+
+		if(!fault_start)
+			fault_start = ktime_get_ns();
+		faults++;
+		if(x < BYTE_RETRIES)
+			retries++;
+	}
+
+	// Sending the byte again didn't work. The display may have lost the nibble synchronization, so it is initialized again
+	reinits++;
+	if((lcd_reinit() == 0) && ((cg < 0) || (lcd_raw_write(0x40 | cg, 0) == 0)) && (lcd_raw_write(byte, rs) == 0))
+	{
+		lcd_recovered();
+		return;
+	}
+
+	lcd_set_offline();
+}
+
+// This function sends a byte like lcd_byte_bits, but each state of the pins comes from the encoding tables and is set with a single call
+static int lcd_byte_bulk(unsigned char byte)
+{
+	const unsigned char * seq = enc.seq[rs_level][byte];
+	u64 high;
+	int err = 0;
+	int x;
+
+	for(x = 0; x < ENC_STATES; x += 2)
+	{
+		jitter_second = x > 0;
+		err |= lcd_gpio_state(seq[x]);		// The nibble, with EN high
+		high = lcd_jitter_high();
+		if(pulse_ns)
+			ndelay(pulse_ns);				// The data is already there, but the EN pulse must be as long as the one of lcd_nibble
+		err |= lcd_gpio_state(seq[x + 1]);	// EN low, the data is kept
+		lcd_jitter_low(high);
+		if(bulk_after_ns)
+			ndelay(bulk_after_ns);
+	}
+	jitter_second = false;
+
+	return err ? -EIO : 0;
+}
+
+// This function sends a byte changing the pins one by one, with lcd_nibble
+static int lcd_byte_bits(unsigned char byte)
+{
+	int err = 0;
+
+	// According to the HD44780 datasheet (page 22), the most significant nibble must be written first, and then the least significant nibble next.
+	err |= lcd_nibble(byte >> 4);	// I do a 4 bits rotate, so the most significant nibble moves to the 4 least significant bits, which are used by the lcd_nibble function
+	jitter_second = true;
+	err |= lcd_nibble(byte);		// I don't do anything to "byte" because the least significant niblle is in place, and the lcd_nibble ignores the most significant nibble
+	jitter_second = false;
+
+	return err;
+}
+
+// How the bytes are sent is chosen when the module is loaded (see bulk), the static call patches lcd_byte to call it directly
+DEFINE_STATIC_CALL(lcd_send, lcd_byte_bulk);
+
+int lcd_byte(unsigned char byte)
+{
+	int err = 0;
+
+	err |= static_call(lcd_send)(byte);
+	
+	// According to the HD44780 datasheet (page 24, table 6) all the commands execution time is 37us (with the exception of the Clear Display, which needs 1.52ms)
+	// So, I give a 40us delay to give enough time to execute any command (more with the slow timing). The Clear Display function must ensure the required delay after calling this function
+	udelay(timing->cmd_us);				
+	
+	bus_bytes++;	// One more byte sent to the display, the bus time accounting uses this counter
+	
+	// Here, the RS pin is set, meaning that the next write to the display will be a character. This is done this way because most of the bytes written to the
+	// display are characters, not commands. When the program needs to write a command to the LCD, it must clear the RS pin before calling this function
+	err |= lcd_gpio_set(RS, 1);
+
+	return err ? -EIO : 0;
+}
+
+// Sends the plans of DISPLAYLCD_IOC_BATCH, the plan of display d to the EN pins of masks[d] (if it is not 0). The HD44780 takes 37us to execute
+// a byte, and the data pins take less than 10us to send one, so instead of waiting after each byte, the next byte of every plan is sent, each one
+// to its displays, and then the driver waits once: the displays execute their bytes at the same time. Like lcd_run_bounded, the CPU is given
+// away between rounds when max_hold_us is set. The busy flag can't be read in the middle of the rounds (display 0 is still executing while the
+// others are written), so display 0 is read back once at the end, where its shadow (already updated by the caller) puts the cursor.
+// A display that failed is redrawn
+static int lcd_batch_send(const struct lcd_plan * plans, const unsigned long * masks)
+{
+	u64 limit = (u64)READ_ONCE(max_hold_us) * NSEC_PER_USEC;
+	u64 start = ktime_get_ns();
+	u64 now;
+	unsigned long failed = 0;
+	unsigned int longest = 0;
+	unsigned int round;
+	unsigned int rounds = 0;	// Rounds sent since start, like the bytes of lcd_run_bounded
+	unsigned short op;
+	bool first = masks[0] & EN_BIT(0);		// Display 0 is written
+	int d;
+
+	for(d = 0; d <= nextra; d++)
+		if(masks[d])
+			longest = max(longest, plans[d].count);
+
+	if(first)
+		ac = -1;	// Not followed during the rounds, see below
+
+	for(round = 0; round < longest; round++)
+	{
+		for(d = 0; d <= nextra; d++)
+		{
+			if(!masks[d] || (round >= plans[d].count))
+				continue;
+
+			op = plans[d].ops[round];
+			en_mask = masks[d];
+			if((rs_level != (op & PLAN_CHAR ? 1 : 0)) && lcd_gpio_set(RS, op & PLAN_CHAR ? 1 : 0))
+				failed |= masks[d];
+			if(static_call(lcd_send)(op & 0xFF))
+				failed |= masks[d];
+			bus_bytes++;
+		}
+		udelay(timing->cmd_us);
+		rounds++;
+
+		now = ktime_get_ns();
+		if(limit && (round + 1 < longest) && (now - start + div_u64(now - start, rounds) > limit))	// The next round would go over the limit
+		{
+			hold_max_ns = max(hold_max_ns, now - start);
+			hold_yields++;
+			cond_resched();
+			start = ktime_get_ns();
+			rounds = 0;
+		}
+	}
+	hold_max_ns = max(hold_max_ns, ktime_get_ns() - start);
+	en_mask = EN_BIT(0);
+	if(lcd_gpio_set(RS, 1))
+		failed |= EN_BIT(0);
+
+	// Now display 0 must have its address counter where its shadow says
+	if(first && !(failed & EN_BIT(0)))
+	{
+		ac = lcd.cursor;
+		if(lcd_check())
+			failed |= EN_BIT(0);
+	}
+
+	if(!failed)
+		return 0;
+
+	// Display 0 is recovered like after a failed write, and the others are initialized again (there's no way to know if they answer)
+	if((failed & EN_BIT(0)) && !offline)
+	{
+		if(!fault_start)
+			fault_start = ktime_get_ns();
+		faults++;
+		reinits++;
+		if(lcd_reinit() == 0)
+			lcd_recovered();
+		else
+			lcd_set_offline();
+	}
+	if(failed & ~EN_BIT(0))
+	{
+		extra_faults++;
+		lcd_extra_redraw(failed & ~EN_BIT(0));
+	}
+	return -EIO;
+}
+
+// Changes the geometry (rows and cols of 0 keep the current ones) or the timing (NULL keeps the current one) of the display, which is initialized
+// again and redrawn from the shadow. The row addresses are kept when only the timing changes, go back to the default ones when the rows or the
+// columns change, and are set when offsets is not NULL (one for each row). The frame history starts again
+static int lcd_reconfigure(int rows, int cols, const unsigned char * offsets, int noffsets, const struct lcd_timing * t)
+{
+	unsigned char keep[MAX_ROWS];
+	int ret = 0;
+
+	if(lcd_lock())
+		return -ERESTARTSYS;
+
+	if(!rows)
+		rows = lcd.rows;
+	if(!cols)
+		cols = lcd.cols;
+	if(!t)
+		t = timing;
+
+	if(!offsets && (rows == lcd.rows) && (cols == lcd.cols))
+	{
+		memcpy(keep, lcd.offsets, sizeof(keep));
+		offsets = keep;
+	}
+	else if(offsets && (noffsets != rows))
+		ret = -EINVAL;
+
+	if(!ret && lcd_geometry(&lcd, rows, cols, offsets))
+		ret = -EINVAL;
+
+	if(!ret)
+	{
+		if(t != timing)		// What was measured with the old timing doesn't apply anymore
+		{
+			timing = t;
+			lcd_delays();
+			bus_ns_total = 0;
+			bus_bytes_total = 0;
+		}
+		lcd_hist_reset();
+		lcd_cache_reset();
+		if(!offline && lcd_reinit())
+			lcd_set_offline();
+		op_bytes = bus_bytes;	// Like the initialization when the module is loaded, this is not accounted to the process
+	}
+
+	lcd_unlock();
+
+	return ret;
+}
+
+// The attributes in /sys/class/displaylcdclass/displaylcd, to change the display while the module is loaded (for example, to try another panel):
+//     rows, cols       the geometry, up to 4 rows and 80 characters
+//     row_offsets      the display memory address where each row starts, like "0x00 0x40 0x14 0x54" for a 20x4 display
+//     timing           the timing profile, the one in use is shown in brackets
+static ssize_t rows_show(struct device * d, struct device_attribute * attr, char * buf)
+{
+	return sysfs_emit(buf, "%d\n", lcd.rows);
+}
+
+static ssize_t rows_store(struct device * d, struct device_attribute * attr, const char * buf, size_t len)
+{
+	int rows;
+	int ret;
+
+	ret = kstrtoint(buf, 0, &rows);
+	if(!ret)
+		ret = rows > 0 ? lcd_reconfigure(rows, 0, NULL, 0, NULL) : -EINVAL;
+
+	return ret ? ret : len;
+}
+static DEVICE_ATTR_RW(rows);
+
+static ssize_t cols_show(struct device * d, struct device_attribute * attr, char * buf)
+{
+	return sysfs_emit(buf, "%d\n", lcd.cols);
+}
+
+static ssize_t cols_store(struct device * d, struct device_attribute * attr, const char * buf, size_t len)
+{
+	int cols;
+	int ret;
+
+	ret = kstrtoint(buf, 0, &cols);
+	if(!ret)
+		ret = cols > 0 ? lcd_reconfigure(0, cols, NULL, 0, NULL) : -EINVAL;
+
+	return ret ? ret : len;
+}
+static DEVICE_ATTR_RW(cols);
+
+static ssize_t row_offsets_show(struct device * d, struct device_attribute * attr, char * buf)
+{
+	int n = 0;
+	int x;
+
+	mutex_lock(&lcd_mutex);
+	for(x = 0; x < lcd.rows; x++)
+		n += sysfs_emit_at(buf, n, "%s0x%02x", x ? " " : "", lcd.offsets[x]);
+	mutex_unlock(&lcd_mutex);
+
+	return n + sysfs_emit_at(buf, n, "\n");
+}
+
+static ssize_t row_offsets_store(struct device * d, struct device_attribute * attr, const char * buf, size_t len)
+{
+	unsigned char offsets[MAX_ROWS];
+	int v[MAX_ROWS];
+	int ret;
+	int n;
+	int x;
+
+	n = sscanf(buf, "%i %i %i %i", &v[0], &v[1], &v[2], &v[3]);
+	if(n < 1)
+		return -EINVAL;
+	for(x = 0; x < n; x++)
+	{
+		if((v[x] < 0) || (v[x] > 0x67))
+			return -EINVAL;
+		offsets[x] = v[x];
+	}
+
+	ret = lcd_reconfigure(0, 0, offsets, n, NULL);
+
+	return ret ? ret : len;
+}
+static DEVICE_ATTR_RW(row_offsets);
+
+static ssize_t timing_show(struct device * d, struct device_attribute * attr, char * buf)
+{
+	int n = 0;
+	int x;
+
+	for(x = 0; x < ARRAY_SIZE(timings); x++)
+		n += sysfs_emit_at(buf, n, &timings[x] == timing ? "%s[%s]" : "%s%s", x ? " " : "", timings[x].name);
+
+	return n + sysfs_emit_at(buf, n, "\n");
+}
+
+static ssize_t timing_store(struct device * d, struct device_attribute * attr, const char * buf, size_t len)
+{
+	int ret;
+	int x;
+
+	for(x = 0; x < ARRAY_SIZE(timings); x++)
+	{
+		if(sysfs_streq(buf, timings[x].name))
+		{
+			ret = lcd_reconfigure(0, 0, NULL, 0, &timings[x]);
+			return ret ? ret : len;
+		}
+	}
+
+	return -EINVAL;
+}
+static DEVICE_ATTR_RW(timing);
+
+// The attributes row1 to row4 show the rows of the display, and writing them changes a whole row at once, without positioning the cursor first:
+//     echo "Temp 23.5C" > /sys/class/displaylcdclass/displaylcd/row1
+// The text is padded with spaces (or truncated) to the row width, the new line added by echo is ignored, and only the characters that
+// changed are sent. Rows that the display doesn't have (see rows_show) give an error. With a translation table loaded (DISPLAYLCD_IOC_CHARMAP)
+// the text is UTF-8, like the text written to /dev/displaylcd.
+static ssize_t lcd_row_show(int row, char * buf)
+{
+	int n;
+
+	mutex_lock(&lcd_mutex);
+	n = row < lcd.rows ? sysfs_emit(buf, "%.*s\n", lcd.cols, &lcd.shadow[row * lcd.cols]) : -ENXIO;
+	mutex_unlock(&lcd_mutex);
+
+	return n;
+}
+
+static ssize_t lcd_row_store(int row, const char * buf, size_t len)
+{
+	unsigned char frame[MAX_CELLS];
+	unsigned char codes[4 * MAX_CELLS];
+	struct lcd_plan plan;
+	size_t n = len;
+
+	if(n && (buf[n - 1] == '\n'))
+		n--;
+
+	if(lcd_lock())
+		return -ERESTARTSYS;
+
+	if(row >= lcd.rows)
+	{
+		lcd_unlock();
+		return -ENXIO;
+	}
+
+	// Like /dev/displaylcd, the text is UTF-8 when a translation table is loaded. A character takes 4 bytes at most, so the first
+	// 4 * cols bytes have all the characters that fit in the row
+	if(charmap_on)
+	{
+		n = lcd_translate(&charmap, buf, min_t(size_t, n, 4 * lcd.cols), codes);
+		buf = (const char *)codes;
+	}
+
+	// The new frame is the shadow with the row replaced, so the planner sends only what changed in that row
+	memcpy(frame, lcd.shadow, sizeof(frame));
+	memset(&frame[row * lcd.cols], ' ', lcd.cols);
+	memcpy(&frame[row * lcd.cols], buf, min_t(size_t, n, lcd.cols));
+
+	lcd_trace(TRACE_SHOW, frame, lcd_cells(&lcd));
+	lcd_show_cached(frame, &plan);
+
+	lcd_unlock();
+
+	return len;
+}
+
+#define ROW_ATTR(n) \
+static ssize_t row##n##_show(struct device * d, struct device_attribute * attr, char * buf) \
+{ \
+	return lcd_row_show(n - 1, buf); \
+} \
+static ssize_t row##n##_store(struct device * d, struct device_attribute * attr, const char * buf, size_t len) \
+{ \
+	return lcd_row_store(n - 1, buf, len); \
+} \
+static DEVICE_ATTR_RW(row##n)
+
+ROW_ATTR(1);
+ROW_ATTR(2);
+ROW_ATTR(3);
+ROW_ATTR(4);
+
+static struct attribute * panel_attrs[] = {
+	&dev_attr_rows.attr,
+	&dev_attr_cols.attr,
+	&dev_attr_row_offsets.attr,
+	&dev_attr_timing.attr,
+	&dev_attr_row1.attr,
+	&dev_attr_row2.attr,
+	&dev_attr_row3.attr,
+	&dev_attr_row4.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(panel);
+
+// Measures how long a GPIO change takes, by toggling the RS pin while EN is low (the display only looks at RS when EN goes high, so this
+// is harmless), and then the same with all the pins at once. The shortest of a few batches is used, so interrupts in the middle of a batch
+// don't make the delays too short. RS is left low
+static void lcd_measure_gpio(void)
+{
+	unsigned long state;
+	u64 start;
+	u64 best = U64_MAX;
+	u64 best_array = U64_MAX;
+	int r;
+	int x;
+
+	for(r = 0; r < 8; r++)
+	{
+		start = ktime_get_ns();
+		for(x = 0; x < 32; x++)
+			gpio_set_value(pins[RS].gpio, x & 1);
+		best = min(best, ktime_get_ns() - start);
+
+		start = ktime_get_ns();
+		for(x = 0; x < 32; x++)
+		{
+			state = (x & 1) << RS;
+			gpiod_set_raw_array_value(ENC_PINS, descs, NULL, &state);
+		}
+		best_array = min(best_array, ktime_get_ns() - start);
+	}
+	gpio_set_value(pins[RS].gpio, 0);
+	rs_level = 0;
+
+	gpio_ns = div_u64(best, 32);
+	array_ns = div_u64(best_array, 32);
+
+	lcd_delays();
+}
+
+// Called when the module is loaded and when the timing profile changes, with lcd_mutex held (or before the display is used)
+static void lcd_delays(void)
+{
+	unsigned int cycle;
+
+	setup_ns = EN_SETUP_NS;
+	hold_ns = EN_HOLD_NS;
+	after_ns = EN_AFTER_NS;
+	pulse_ns = EN_SETUP_NS + EN_HOLD_NS;
+	bulk_after_ns = EN_AFTER_NS;
+
+	// Between two pin changes there is at least the time of one GPIO call, so it is taken out of each delay
+	if(compensate)
+	{
+		setup_ns = EN_SETUP_NS > gpio_ns ? EN_SETUP_NS - gpio_ns : 0;
+		hold_ns = EN_HOLD_NS > gpio_ns ? EN_HOLD_NS - gpio_ns : 0;
+		after_ns = EN_AFTER_NS > gpio_ns ? EN_AFTER_NS - gpio_ns : 0;
+		pulse_ns = EN_SETUP_NS + EN_HOLD_NS > array_ns ? EN_SETUP_NS + EN_HOLD_NS - array_ns : 0;
+		bulk_after_ns = EN_AFTER_NS > array_ns ? EN_AFTER_NS - array_ns : 0;
+	}
+
+	// With fast GPIOs the nibbles could come closer than tcycE, so what is missing is waited after EN goes low. lcd_nibble makes 6 pin
+	// changes from one EN rising edge to the next (EN, the 4 data pins, EN low), lcd_byte_bulk makes 2
+	cycle = setup_ns + hold_ns + after_ns + 6 * gpio_ns;
+	if(cycle < timing->cycle_ns)
+		after_ns += timing->cycle_ns - cycle;
+	cycle = pulse_ns + bulk_after_ns + 2 * array_ns;
+	if(cycle < timing->cycle_ns)
+		bulk_after_ns += timing->cycle_ns - cycle;
+}
+
+// Shows the contents of /sys/kernel/debug/displaylcd/timing: the measured time of the GPIO changes and the delays that are used
+static int timing_debug_show(struct seq_file * m, void * v)
+{
+	seq_printf(m, "gpio_ns: %u\n", gpio_ns);
+	seq_printf(m, "array_ns: %u\n", array_ns);
+	seq_printf(m, "compensate: %d\n", compensate);
+	seq_printf(m, "cycle_ns: %u\n", timing->cycle_ns);
+	seq_printf(m, "setup_ns: %u (datasheet %u)\n", setup_ns, EN_SETUP_NS);
+	seq_printf(m, "hold_ns: %u (datasheet %u)\n", hold_ns, EN_HOLD_NS);
+	seq_printf(m, "after_ns: %u (datasheet %u)\n", after_ns, EN_AFTER_NS);
+	seq_printf(m, "bulk_pulse_ns: %u (datasheet %u)\n", pulse_ns, EN_SETUP_NS + EN_HOLD_NS);
+	seq_printf(m, "bulk_after_ns: %u (datasheet %u)\n", bulk_after_ns, EN_AFTER_NS);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(timing_debug);
+
+// This function sends the initialization sequence to the display. It is used when the module is loaded, and again when the display
+// must be recovered after an error. It returns an error if any pin couldn't be changed
+static int lcd_hw_init(void)
+{
+	int err = 0;
+
+	err |= lcd_gpio_set(RS, 0);		// The initialization is made of commands, and RS may be high if the display was already in use
+	ac = -1;						// And the display may be anywhere
+
+	// Perform the LCD initialization. The following commands resets the display circuit, configure it to 4 bits data width, 2 lines and 5x8 caracters
+	//  The commands follows the instructions presented in the HD44780 datasheet, page 46
+	mdelay(15);
+	err |= lcd_nibble(0x03);
+	mdelay(5);
+	err |= lcd_nibble(0x03);
+	udelay(100);
+	err |= lcd_nibble(0x03);
+	
+	// The datasheet does not specify the next commands minimum delay (or at least I didn't find it), so I give 40us, like any other command (except the Clear Display)
+	udelay(timing->cmd_us);
+	err |= lcd_nibble(0x02); 	// I have no idea what this nibbler means, but the datasheet says so... 	
+	udelay(timing->cmd_us);
+	
+	// Function Set
+	// The fields are 0 0 1 DL , N F * *
+	// DL = Data Legth (0 == 4 bits)
+	// N = Number of display lines (1 == 2 lines)
+	// F = Character font (0 == 5x8 dots)
+	// Sending 0010,1000 sets the display to 4 bits communication, 2 lines and 5x8 character format                                       
+	err |= lcd_nibble(0x02);
+	err |= lcd_nibble(0x08);
+	udelay(timing->cmd_us);
+	
+	// Display On/Off control
+	// The fields are 0 0 0 0 , 1 D C B
+	// D = Display on/off (1 == on)
+	// C = Cursor on/off (0 == off
+	// B = Blink on/off (0 == off)
+	// Sending 0000,1100 sets the display on, no cursor and no blinking
+	err |= lcd_nibble(0x00);
+	err |= lcd_nibble(0x0C);
+	udelay(timing->cmd_us);
+                                                  
+	// Entry mode set
+	// The fields are 0 0 0 0 , 0 1 I/D S
+	// I/D = Increment/decrement (1 = increment)
+	// S = shift (0 = don't shift)
+	// Sending 0000,0110 sets the display to increment the cursor and don't shift the display
+	err |= lcd_nibble(0x00);
+	err |= lcd_nibble(0x06);                                                                                                    
+	udelay(timing->cmd_us);
+
+	return err ? -EIO : 0;
+}
+
+// Gives back every GPIO the driver requested: the display pins, the EN pins of the extra displays and the RW pin
+static void lcd_free_pins(void)
+{
+	int x;
+
+	gpio_free_array(pins, ARRAY_SIZE(pins));
+	for(x = 0; x < nextra; x++)
+		gpio_free(extra_en[x]);
+	if(rw_pin >= 0)
+		gpio_free(rw_pin);
+}
+
+static int __init inicializa(void)
+{
+	unsigned char bit[ENC_PINS];
+	int ret;
+	int x;
+
+	ret = gpio_request_array(pins, ARRAY_SIZE(pins));	// Here, a request is made to the kernel passing the global gpio structure. This command returns 0 if is OK
+	
+	if(ret)		// If ret is not zero, the request to the GPIOs failed, there's nothing else this module can do to command the display
+	{
+		printk(KERN_ERR "Unable to request the GPIOs for the LCD display. Errro code:%d\n", ret);
+		return ret;
+	}
+
+	// The encoding tables use the order of the pins array, bit x of a state is pins[x]
+	BUILD_BUG_ON(ARRAY_SIZE(pins) != ENC_PINS);
+	for(x = 0; x < ENC_PINS; x++)
+	{
+		descs[x] = gpio_to_desc(pins[x].gpio);
+		bit[x] = 1 << x;
+	}
+	lcd_encode_init(&enc, bit);
+	if(!bulk)
+		static_call_update(lcd_send, lcd_byte_bits);
+	lcd_measure_gpio();
+
+	// The displays of extra_en that can't have their EN pin are left out, with the ones after them
+	for(x = 0; x < nextra; x++)
+	{
+		ret = gpio_request_one(extra_en[x], GPIOF_OUT_INIT_LOW, "LCD extra EN pin");
+		if(ret)
+		{
+			printk(KERN_ERR "LCD Display Driver: unable to request the EN pin of display %d. Error code:%d\n", x + 1, ret);
+			break;
+		}
+		descs[ENC_PINS + x] = gpio_to_desc(extra_en[x]);
+	}
+	nextra = x;
+
+	if(rw_pin >= 0)
+	{
+		ret = gpio_request_one(rw_pin, GPIOF_OUT_INIT_LOW, "LCD RW pin");	// Low is write, the display is only read by lcd_read_status
+		if(ret)
+		{
+			printk(KERN_ERR "LCD Display Driver: unable to request the RW pin, the busy flag will not be read. Error code:%d\n", ret);
+			rw_pin = -1;
+		}
+		else
+			static_branch_enable(&readback_key);
+	}
+	
+	mutex_lock(&lcd_mutex);
+
+	// All the displays are initialized together. If display 0 doesn't answer, the driver works anyway, and the display is probed until it does
+	for(x = 0; x <= nextra; x++)
+		en_mask |= EN_BIT(x);
+	ret = lcd_hw_init();
+	en_mask = EN_BIT(0);
+	if(ret)
+		lcd_set_offline();
+
+	for(x = 1; x <= nextra; x++)
+	{
+		lcd_core_init(&others[x - 1], &gpio_bus, (void *)(long)x);
+		lcd_cls(&others[x - 1]);
+		others[x - 1].dirty = false;
+	}
+	
+	// Now I clear the display, it will put the cursor in the first position and set RS to character mode
+	lcd_core_init(&lcd, &gpio_bus, NULL);
+	lcd_cls(&lcd);
+	
+	lcd_print(&lcd, line1);
+	lcd_pos(&lcd, 17);
+	lcd_print(&lcd, line2);
+
+	// The frame history starts from what the display is showing now
+	lcd_hist_reset();
+	lcd.dirty = false;
+
+	mutex_unlock(&lcd_mutex);
+	      
+	// Register the device driver as a character device, passing the global fops structure where the methods are defined
+	major = register_chrdev(0, "displaylcd", &fops);
+	              
+	// Check if the kernel registered the driver, otherwise the registering failed, and there's nothing else to do...
+	if(major < 0)
+	{
+		printk(KERN_ALERT "Registering the LCD Display Device Driver failed! Error:%d\n", major);
+		cancel_delayed_work_sync(&probe_work);
+		lcd_free_pins();
+		return major;
+	}
+	
+	// Register the device driver class, I'm not sure wht this means
+	devclass = class_create(THIS_MODULE, "displaylcdclass");
+	devclass->devnode = classmode;
+	
+	if( IS_ERR(devclass) )	// Check if the class registering failed
+	{
+		unregister_chrdev(major, "displaylcd");	// If there's an error, unregister the character device, because there's nothing else to do
+		printk(KERN_ALERT "Failed registering LCD Display Device Driver class\n");
+		cancel_delayed_work_sync(&probe_work);
+		lcd_free_pins();
+		return PTR_ERR(devclass);
+	}
+	
+	// Create the device driver under the /dev/displaylcd directory with minor number 0
+	dev = device_create_with_groups(devclass, NULL, MKDEV(major, 0), NULL, panel_groups, "displaylcd");	// With the panel attributes (see rows_show)
+	
+	if( IS_ERR(dev) )	// Check if there device creation failed
+	{
+		class_destroy(devclass);	// Removes the device class created above
+		unregister_chrdev(major, "displaylcd");
+		printk(KERN_ALERT "Failed creating the LCD Display Device Driver\n");
+		cancel_delayed_work_sync(&probe_work);
+		lcd_free_pins();
+		return PTR_ERR(dev);
+	}
+
+	// Create the device driver under /dev/displaylcd_cls directry with minor number 1
+	dev = device_create(devclass, NULL, MKDEV(major, 1), NULL, "displaylcd_cls");
+	
+	if( IS_ERR(dev) )
+	{
+		device_destroy(devclass, MKDEV(major, 0));
+		class_unregister(devclass);
+		class_destroy(devclass);
+		unregister_chrdev(major, "displaylcd");
+		printk(KERN_ALERT "Failed creating displaylcd_cls\n");
+		cancel_delayed_work_sync(&probe_work);
+		lcd_free_pins();
+		return PTR_ERR(dev);
+	}
+	
+	// Create the device driver under /dev/displaylcd_pos directry with minor number 2
+	dev = device_create(devclass, NULL, MKDEV(major, 2), NULL, "displaylcd_pos");
+	
+	if( IS_ERR(dev) )
+	{
+		device_destroy(devclass, MKDEV(major, 0));
+		device_destroy(devclass, MKDEV(major, 1));
+		class_unregister(devclass);
+		class_destroy(devclass);
+		unregister_chrdev(major, "displaylcd");
+		unregister_chrdev(major, "displaylcd_cls");
+		printk(KERN_ALERT "Failed creating displaylcd_pos");	
+		cancel_delayed_work_sync(&probe_work);
+		lcd_free_pins();
+		return PTR_ERR(dev);
+	}
+
+	// Create the device driver under /dev/displaylcd_log directry with minor number 3
+	dev = device_create(devclass, NULL, MKDEV(major, LOG_MINOR), NULL, "displaylcd_log");
+
+	if( IS_ERR(dev) )
+	{
+		device_destroy(devclass, MKDEV(major, 0));
+		device_destroy(devclass, MKDEV(major, 1));
+		device_destroy(devclass, MKDEV(major, 2));
+		class_unregister(devclass);
+		class_destroy(devclass);
+		unregister_chrdev(major, "displaylcd");
+		unregister_chrdev(major, "displaylcd_cls");
+		unregister_chrdev(major, "displaylcd_pos");
+		printk(KERN_ALERT "Failed creating displaylcd_log");
+		cancel_delayed_work_sync(&probe_work);
+		lcd_free_pins();
+		return PTR_ERR(dev);
+	}
+
+	// Without memory for the log, /dev/displaylcd_log is there but refuses the writes
+	if(log_depth)
+		log_ring = kcalloc(log_depth, MAX_CELLS, GFP_KERNEL);
+	if(!log_ring)
+		printk(KERN_WARNING "LCD Display Driver: the log is disabled\n");
+
+	// The diagnostic files are created under /sys/kernel/debug/displaylcd. If debugfs is not available the driver works anyway, so errors are ignored
+	debugdir = debugfs_create_dir("displaylcd", NULL);
+	debugfs_create_file("consumers", 0444, debugdir, NULL, &consumers_fops);
+	debugfs_create_file("utilization", 0444, debugdir, NULL, &utilization_fops);
+	debugfs_create_file("history", 0444, debugdir, NULL, &history_fops);
+	debugfs_create_file("trace", 0644, debugdir, NULL, &trace_fops);
+	debugfs_create_bool("trace_enable", 0644, debugdir, &trace_enable);
+	debugfs_create_file("jitter", 0644, debugdir, NULL, &jitter_fops);
+	debugfs_create_file_unsafe("jitter_enable", 0644, debugdir, NULL, &jitter_enable_fops);
+	debugfs_create_file("faults", 0444, debugdir, NULL, &faults_fops);
+	debugfs_create_file("timing", 0444, debugdir, NULL, &timing_debug_fops);
+	debugfs_create_file("plancache", 0444, debugdir, NULL, &plancache_fops);
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+	fault_create_debugfs_attr("fail_gpio", debugdir, &fail_gpio);
+	debugfs_create_file_unsafe("fail_gpio_enable", 0644, debugdir, NULL, &fail_gpio_enable_fops);
+#endif
+	               	
+	return 0;
+}
+
+static void __exit finaliza(void)
+{
+	int x;
+
+	// The device files go away first, so nothing new can be written while the rest is torn down
+	device_destroy(devclass, MKDEV(major, 0));
+	device_destroy(devclass, MKDEV(major, 1));
+	device_destroy(devclass, MKDEV(major, 2));
+	device_destroy(devclass, MKDEV(major, LOG_MINOR));
+
+	// The animations are stopped before their work is cancelled, so anim_work doesn't schedule itself again
+	mutex_lock(&lcd_mutex);
+	for(x = 0; x < DISPLAYLCD_MAX_ANIMS; x++)
+		anims[x].active = false;
+	mutex_unlock(&lcd_mutex);
+	cancel_delayed_work_sync(&anim_work);
+	cancel_delayed_work_sync(&probe_work);
+
+	// Only now, with no work left to touch the bus, the GPIOs are given back
+	debugfs_remove_recursive(debugdir);
+	lcd_free_pins();
+	class_unregister(devclass);
+	class_destroy(devclass);
+	unregister_chrdev(major, "displaylcd");
+	unregister_chrdev(major, "displaylcd_cls");
+	unregister_chrdev(major, "displaylcd_pos");
+	kfree(log_ring);
+}
+
+static char * classmode(struct device * dev, umode_t * mode)
+{
+	*mode = 0666;
+	return NULL;
+}
+
+module_init(inicializa);
+module_exit(finaliza);
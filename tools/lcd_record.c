@@ -0,0 +1,99 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "lcd_record.h"
+
+void lcd_record_write(void * priv, unsigned char byte, int rs)
+{
+	struct lcd_record * rec = priv;
+
+	if(rec->log_len < RECORD_LOG)
+		rec->log[rec->log_len++] = rs ? PLAN_CHAR | byte : byte;
+
+	if(rs && (rec->cgaddr >= 0))	// A row of a custom character
+	{
+		rec->cgram[rec->cgaddr] = byte;
+		rec->cgaddr = (rec->cgaddr + (rec->dec ? -1 : 1)) & 0x3F;
+		rec->bus_ns += BYTE_NS;
+		return;
+	}
+
+	if(rs)	// A character is written in the address counter position, which moves to the next position like lcd_next (or lcd_prev) says
+	{
+		rec->ddram[rec->ac] = byte;
+		rec->ac = rec->dec ? lcd_prev(rec->ac) : lcd_next(rec->ac);
+		rec->chars++;
+		rec->bus_ns += BYTE_NS;
+		return;
+	}
+
+	rec->commands++;
+	rec->bus_ns += BYTE_NS;
+
+	if(byte & 0x80)			// Set DDRAM Address
+	{
+		rec->ac = byte & 0x7F;
+		rec->cgaddr = -1;
+	}
+	else if(byte & 0x40)	// Set CGRAM Address
+		rec->cgaddr = byte & 0x3F;
+	else if(byte == 0x01)	// Clear Display
+	{
+		rec->cgaddr = -1;
+		memset(rec->ddram, ' ', sizeof(rec->ddram));
+		rec->ac = 0;
+		rec->dec = false;
+		rec->bus_ns += CLEAR_NS;
+	}
+	else if(byte <= 0x03)	// Return Home
+	{
+		rec->cgaddr = -1;
+		rec->ac = 0;
+		rec->bus_ns += CLEAR_NS;
+	}
+	else if((byte & 0xFC) == LCD_ENTRY)	// Entry Mode Set
+		rec->dec = !(byte & LCD_ENTRY_INC);
+}
+
+const struct lcd_bus lcd_record_bus = {
+	.write = lcd_record_write
+};
+
+void lcd_record_init(struct lcd_record * rec)
+{
+	memset(rec, 0, sizeof(*rec));
+	memset(rec->ddram, ' ', sizeof(rec->ddram));
+	rec->cgaddr = -1;
+}
+
+void lcd_record_reset_log(struct lcd_record * rec)
+{
+	rec->commands = 0;
+	rec->chars = 0;
+	rec->bus_ns = 0;
+	rec->log_len = 0;
+}
+
+void lcd_record_frame(const struct lcd_record * rec, const struct lcd_core * lcd, unsigned char * frame)
+{
+	int x;
+
+	for(x = 0; x < lcd_cells(lcd); x++)
+		frame[x] = rec->ddram[lcd_addr(lcd, x)];
+}
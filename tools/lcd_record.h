@@ -0,0 +1,50 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// The recording backend. It is a bus for the driver core (see displaylcd_core.h) that, instead of moving GPIO pins, emulates the
+// display memory of the HD44780 and takes note of every byte sent, with the bus time the real display would take.
+
+#ifndef LCD_RECORD_H
+#define LCD_RECORD_H
+
+#include "displaylcd_core.h"
+
+#define RECORD_LOG 4096
+
+struct lcd_record {
+	unsigned char ddram[0x80];			// The emulated display memory (0x00 to 0x27 is the first line, 0x40 to 0x67 the second)
+	unsigned char ac;					// The emulated address counter (cursor)
+	bool dec;							// The emulated entry mode moves the address counter to the left
+	unsigned char cgram[64];			// The emulated custom characters, 8 rows of each
+	int cgaddr;							// The CGRAM address, when the characters go to the CGRAM (-1 when they go to the display memory)
+	unsigned long commands;				// Number of commands received
+	unsigned long chars;				// Number of characters received
+	unsigned long long bus_ns;			// Bus time the real display would take, with the delays used by the driver
+	unsigned short log[RECORD_LOG];		// Every byte received, with PLAN_CHAR set for characters (like the ops of a plan)
+	unsigned int log_len;				// Number of bytes in the log. When the log is full, the older bytes are kept
+};
+
+extern const struct lcd_bus lcd_record_bus;
+void lcd_record_write(void *, unsigned char, int);			// The write of lcd_record_bus, for a core built with LCD_BUS_WRITE
+
+void lcd_record_init(struct lcd_record *);					// Starts a recording with a blank display
+void lcd_record_reset_log(struct lcd_record *);				// Clears the log and the counters, the display memory is kept
+void lcd_record_frame(const struct lcd_record *, const struct lcd_core *, unsigned char *);	// Copies the visible content of the emulated display, in the geometry of the core
+
+#endif
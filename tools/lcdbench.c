@@ -0,0 +1,231 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Microbenchmarks of the driver core, using the recording backend instead of the display.
+// For every case it prints the CPU time per operation, and the bytes and bus time the real display would take.
+//
+// Usage: lcdbench [iterations]
+//
+// The flush cases run displaylcd_core.c as the driver does. In the tools the core calls its bus through a pointer for every byte, while the
+// module calls the GPIO bus directly (see LCD_BUS_WRITE in displaylcd_core.c). flush_direct runs the same frames as flush_full with a copy
+// of the core built like the module, calling the recording backend directly, so the two cpu_ns/byte columns compare both ways. To see the
+// cost of the indirect calls in a kernel with retpolines, build with make -C tools CFLAGS="-O2 -Wall -I.. -mindirect-branch=thunk" (x86 gcc)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "displaylcd_core.h"
+#include "lcd_record.h"
+
+static struct lcd_core lcd;
+static struct lcd_record rec;
+static unsigned char frames[2][CELLS];
+static struct lcd_plan plan;
+static struct lcd_encoding enc;
+static unsigned char states[CELLS * ENC_STATES];
+static const unsigned char pin_bits[ENC_PINS] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20 };	// The driver wiring, bit x is pins[x]
+static volatile int sink;		// Keeps the compiler from throwing away the results
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_parse_pos(long i)
+{
+	sink += lcd_parse_pos(&lcd, i & 1 ? "17" : "5", i & 1 ? 2 : 1);
+}
+
+static void bench_write_pos(long i)
+{
+	lcd_handle_write(&lcd, 2, i & 1 ? "17" : "05", 2);
+}
+
+static void bench_write_text(long i)
+{
+	lcd_handle_write(&lcd, 2, "01", 2);
+	lcd_handle_write(&lcd, 0, i & 1 ? "Raspberry Pi 3  " : "  LCD  Display  ", 16);
+}
+
+// A random cell of the display changes
+static void bench_plan_single(long i)
+{
+	frames[0][rand() % CELLS] = 'A' + i % 26;
+	lcd_plan(&lcd, frames[0], &plan);
+	sink += plan.count;
+}
+
+// Every cell changes
+static void bench_plan_full(long i)
+{
+	lcd_plan(&lcd, frames[1], &plan);
+	sink += plan.count;
+}
+
+// What the plan cache of the driver pays to find a transition: a hash of the new frame, against the lcd_plan of plan_full
+static void bench_hash_full(long i)
+{
+	sink += lcd_hash(frames[i & 1], CELLS);
+}
+
+static void bench_flush_single(long i)
+{
+	frames[0][rand() % CELLS] = 'A' + i % 26;
+	lcd_plan(&lcd, frames[0], &plan);
+	lcd_run(&lcd, &plan);
+}
+
+static void bench_flush_full(long i)
+{
+	lcd_plan(&lcd, frames[i & 1], &plan);
+	lcd_run(&lcd, &plan);
+}
+
+// The same, sent by the core built with LCD_BUS_WRITE (see displaylcd_core_direct.o in the Makefile, its functions have the direct_ prefix)
+void direct_lcd_run(struct lcd_core *, const struct lcd_plan *);
+
+static void bench_flush_direct(long i)
+{
+	lcd_plan(&lcd, frames[i & 1], &plan);
+	direct_lcd_run(&lcd, &plan);
+}
+
+// Pin states of a frame of characters, computed bit by bit like lcd_nibble does
+static void bench_encode_bits(long i)
+{
+	unsigned char n;
+	int x;
+	int y;
+
+	for(x = 0; x < CELLS; x++)
+	{
+		for(y = 0; y < 2; y++)
+		{
+			n = y ? frames[i & 1][x] & 0x0F : frames[i & 1][x] >> 4;
+			states[x * 4 + y * 2] = pin_bits[0] | pin_bits[1];
+			states[x * 4 + y * 2] |= n & 0x01 ? pin_bits[2] : 0;
+			states[x * 4 + y * 2] |= n & 0x02 ? pin_bits[3] : 0;
+			states[x * 4 + y * 2] |= n & 0x04 ? pin_bits[4] : 0;
+			states[x * 4 + y * 2] |= n & 0x08 ? pin_bits[5] : 0;
+			states[x * 4 + y * 2 + 1] = states[x * 4 + y * 2] & ~pin_bits[1];
+		}
+	}
+	sink += states[i % sizeof(states)];
+}
+
+// The same, copied from the encoding tables
+static void bench_encode_table(long i)
+{
+	lcd_encode(&enc, 1, frames[i & 1], CELLS, states);
+	sink += states[i % sizeof(states)];
+}
+
+// The bus of the flush_encoded case. Like lcd_byte_bulk does in the driver, every byte becomes its pin states from the encoding tables,
+// and then goes to the recording backend
+static unsigned char pin_states[ENC_STATES];
+
+static void encoded_write(void * priv, unsigned char byte, int rs)
+{
+	memcpy(pin_states, enc.seq[rs][byte], ENC_STATES);
+	sink += pin_states[byte & (ENC_STATES - 1)];
+	lcd_record_bus.write(priv, byte, rs);
+}
+
+static const struct lcd_bus encoded_bus = {
+	.write = encoded_write
+};
+
+// A whole frame changes, and the core sends it through the encoding tables (the bus is encoded_bus, see benches)
+static void bench_flush_encoded(long i)
+{
+	lcd_plan(&lcd, frames[i & 1], &plan);
+	lcd_run(&lcd, &plan);
+}
+
+struct bench {
+	const char * name;
+	void (*fn)(long);
+	const struct lcd_bus * bus;		// The bus of the core, NULL is the recording backend alone
+};
+
+static const struct bench benches[] = {
+	{ "parse_pos", bench_parse_pos },
+	{ "write_pos", bench_write_pos },
+	{ "write_text", bench_write_text },
+	{ "plan_single", bench_plan_single },
+	{ "plan_full", bench_plan_full },
+	{ "hash_full", bench_hash_full },
+	{ "flush_single", bench_flush_single },
+	{ "flush_full", bench_flush_full },
+	{ "flush_direct", bench_flush_direct },
+	{ "encode_bits", bench_encode_bits },
+	{ "encode_table", bench_encode_table },
+	{ "flush_encoded", bench_flush_encoded, &encoded_bus },
+};
+
+int main(int argc, char ** argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+	unsigned long long start;
+	unsigned long long cpu;
+	unsigned long bytes;
+	unsigned int b;
+	long i;
+
+	if(iterations <= 0)
+	{
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	lcd_encode_init(&enc, pin_bits);
+
+	printf("%-14s %10s %10s %12s %12s\n", "case", "cpu_ns/op", "bytes/op", "bus_us/op", "cpu_ns/byte");
+
+	for(b = 0; b < sizeof(benches) / sizeof(benches[0]); b++)
+	{
+		// Every case starts from a blank display
+		lcd_record_init(&rec);
+		lcd_core_init(&lcd, benches[b].bus ? benches[b].bus : &lcd_record_bus, &rec);
+		memset(frames[0], ' ', CELLS);
+		for(i = 0; i < CELLS; i++)
+			frames[1][i] = 'a' + i % 26;
+		srand(1);
+
+		start = now_ns();
+		for(i = 0; i < iterations; i++)
+			benches[b].fn(i);
+		cpu = now_ns() - start;
+
+		bytes = rec.commands + rec.chars;
+		printf("%-14s %10.1f %10.2f %12.2f", benches[b].name, (double)cpu / iterations, (double)bytes / iterations,
+			(double)rec.bus_ns / iterations / 1000);
+		if(bytes)
+			printf(" %12.2f\n", (double)cpu / bytes);
+		else
+			printf(" %12s\n", "-");
+	}
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Measures the EN pulse timing of the driver with and without CPU and interrupt load. It turns on the timing capture of the driver
+// (/sys/kernel/debug/displaylcd/jitter_enable), writes frames to the display, and prints the distribution of the EN pulse widths and of
+// the gaps between nibbles, compared with the delays used by lcd_nibble. This is done twice: first with the system idle, then with
+// threads spinning on every CPU and threads sleeping for a few microseconds in a loop, which keeps the timer interrupts busy.
+//
+// Usage: lcdjitter [-c cpu_threads] [-i irq_threads] [-n frames] [-d device] [-D debugfs_dir]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "displaylcd.h"
+
+static volatile int stop = 0;
+static const char * debugdir = "/sys/kernel/debug/displaylcd";
+
+// Keeps a CPU busy
+static void * cpu_hog(void * arg)
+{
+	volatile unsigned long x = 0;
+
+	while(!stop)
+		x++;
+	return NULL;
+}
+
+// Sleeps for a few microseconds in a loop, every wake up is a timer interrupt and a context switch
+static void * irq_hog(void * arg)
+{
+	struct timespec ts = { 0, 20000 };
+
+	while(!stop)
+		nanosleep(&ts, NULL);
+	return NULL;
+}
+
+// Writes a string to a file of the driver debugfs directory
+static int debug_write(const char * name, const char * value)
+{
+	char path[256];
+	int ret = 0;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", debugdir, name);
+	fd = open(path, O_WRONLY);
+	if(fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	if(write(fd, value, strlen(value)) < 0)
+	{
+		perror(path);
+		ret = -1;
+	}
+	close(fd);
+	return ret;
+}
+
+static void debug_print(const char * name)
+{
+	char path[256];
+	char line[512];
+	FILE * f;
+
+	snprintf(path, sizeof(path), "%s/%s", debugdir, name);
+	f = fopen(path, "r");
+	if(!f)
+	{
+		perror(path);
+		return;
+	}
+	while(fgets(line, sizeof(line), f))
+		fputs(line, stdout);
+	fclose(f);
+}
+
+// Writes frames to the display, alternating two frames where every character changes
+static int write_frames(int fd, int frames)
+{
+	struct displaylcd_frame frame;
+	int x;
+
+	for(x = 0; x < frames; x++)
+	{
+		memset(frame.frame, x & 1 ? '#' : '-', sizeof(frame.frame));
+		if(ioctl(fd, DISPLAYLCD_IOC_SHOW, &frame) < 0)
+		{
+			perror("DISPLAYLCD_IOC_SHOW");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int measure(const char * title, int fd, int frames, int cpu_threads, int irq_threads)
+{
+	pthread_t * tid;
+	int ret;
+	int x;
+
+	tid = calloc(cpu_threads + irq_threads + 1, sizeof(*tid));	// One more, so the idle run doesn't ask for nothing
+	if(!tid)
+	{
+		perror("calloc");
+		return -1;
+	}
+
+	stop = 0;
+	for(x = 0; x < cpu_threads; x++)
+		pthread_create(&tid[x], NULL, cpu_hog, NULL);
+	for(x = 0; x < irq_threads; x++)
+		pthread_create(&tid[cpu_threads + x], NULL, irq_hog, NULL);
+
+	debug_write("jitter", "0");		// Clears the samples
+	debug_write("jitter_enable", "1");
+	ret = write_frames(fd, frames);
+	debug_write("jitter_enable", "0");
+
+	stop = 1;
+	for(x = 0; x < cpu_threads + irq_threads; x++)
+		pthread_join(tid[x], NULL);
+	free(tid);
+
+	printf("%s (%d cpu threads, %d irq threads)\n", title, cpu_threads, irq_threads);
+	debug_print("jitter");
+	return ret;
+}
+
+int main(int argc, char ** argv)
+{
+	const char * device = "/dev/displaylcd";
+	int cpu_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int irq_threads = 2;
+	int frames = 100;
+	int opt;
+	int fd;
+
+	while((opt = getopt(argc, argv, "c:i:n:d:D:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'c': cpu_threads = atoi(optarg); break;
+			case 'i': irq_threads = atoi(optarg); break;
+			case 'n': frames = atoi(optarg); break;
+			case 'd': device = optarg; break;
+			case 'D': debugdir = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-c cpu_threads] [-i irq_threads] [-n frames] [-d device] [-D debugfs_dir]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(cpu_threads < 0 || irq_threads < 0 || frames < 1)
+	{
+		fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(device, O_WRONLY);
+	if(fd < 0)
+	{
+		perror(device);
+		return 1;
+	}
+
+	if(measure("idle", fd, frames, 0, 0) || measure("loaded", fd, frames, cpu_threads, irq_threads))
+	{
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
+	return 0;
+}
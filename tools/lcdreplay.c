@@ -0,0 +1,282 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Sends a trace recorded by the driver (/sys/kernel/debug/displaylcd/trace) back to the display, or to the emulator (the driver core
+// with the recording backend). The operations can be sent with the original timing, faster, or as fast as possible, and at the end
+// the latency of the operations and the bus time are reported, so different driver versions can be compared with real traffic.
+//
+// Usage: lcdreplay [-e] [-s speed] [-d device] tracefile
+//   -e         replays against the emulator instead of the device files (it has no translation table, UTF-8 text shows its bytes)
+//   -s speed   1 keeps the original timing (default), 10 is ten times faster, 0 doesn't wait between operations
+//   -d device  the base name of the device files (default /dev/displaylcd, so /dev/displaylcd_cls and /dev/displaylcd_pos are used too)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "displaylcd.h"
+#include "displaylcd_core.h"
+#include "lcd_record.h"
+
+#define OP_PRINT 0	// The same values used by the driver: the minor number of the device file, 3 for a frame update or 4 for a mode change
+#define OP_CLS 1
+#define OP_POS 2
+#define OP_SHOW 3
+#define OP_MODE 4	// The data is the Display On/Off Control and the Entry Mode Set commands
+#define OPS 5
+#define OP_DATA (4 * 30)	// The longest entry: a frame, or a write of 30 characters in UTF-8
+
+struct op {
+	unsigned long long ns;
+	int op;
+	size_t len;
+	char data[OP_DATA];
+};
+
+static const char * const op_names[] = { "print", "cls", "pos", "show", "mode" };
+
+static struct lcd_core lcd;
+static struct lcd_record rec;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+// Parses a line of the trace: the time in nanoseconds, the operation name and the data in hexadecimal
+static int parse_line(const char * line, struct op * op)
+{
+	char name[16];
+	char hex[2 * OP_DATA + 1] = "";
+	unsigned int byte;
+	size_t x;
+
+	if(sscanf(line, "%llu %15s %240s", &op->ns, name, hex) < 2)
+		return -1;
+
+	for(op->op = 0; op->op < OPS; op->op++)
+		if(strcmp(name, op_names[op->op]) == 0)
+			break;
+	if(op->op == OPS)
+		return -1;
+
+	op->len = strlen(hex) / 2;
+	for(x = 0; x < op->len; x++)
+	{
+		if(sscanf(&hex[2 * x], "%2x", &byte) != 1)
+			return -1;
+		op->data[x] = byte;
+	}
+
+	return 0;
+}
+
+static int replay_emulator(const struct op * op)
+{
+	struct lcd_plan plan;
+	unsigned char frame[MAX_CELLS];
+
+	if(op->op == OP_SHOW)
+	{
+		memset(frame, ' ', sizeof(frame));
+		memcpy(frame, op->data, op->len < MAX_CELLS ? op->len : MAX_CELLS);
+		lcd_plan(&lcd, frame, &plan);
+		lcd_run(&lcd, &plan);
+	}
+	else if(op->op == OP_MODE)
+	{
+		if(op->len == 2)
+			lcd_mode(&lcd, op->data[0], op->data[1]);
+	}
+	else
+		lcd_handle_write(&lcd, op->op, op->data, op->len);
+
+	return 0;
+}
+
+// Every operation opens and closes the device file, like a shell script does, because the driver allows only one writer at a time
+static int replay_device(const char * base, const struct op * op)
+{
+	static const char * const suffixes[] = { "", "_cls", "_pos", "", "" };
+	struct displaylcd_frame frame;
+	struct displaylcd_mode mode = { 0 };
+	char path[256];
+	int ret = 0;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s%s", base, suffixes[op->op]);
+	fd = open(path, O_WRONLY);
+	if(fd < 0)
+		return -errno;
+
+	if(op->op == OP_SHOW)
+	{
+		memset(frame.frame, ' ', sizeof(frame.frame));
+		memcpy(frame.frame, op->data, op->len < sizeof(frame.frame) ? op->len : sizeof(frame.frame));
+		if(ioctl(fd, DISPLAYLCD_IOC_SHOW, &frame) < 0)
+			ret = -errno;
+	}
+	else if(op->op == OP_MODE)
+	{
+		// The commands are turned back into the flags of the ioctl
+		if(op->len == 2)
+		{
+			mode.flags |= op->data[0] & LCD_CONTROL_DISPLAY ? 0 : DISPLAYLCD_OFF;
+			mode.flags |= op->data[0] & LCD_CONTROL_CURSOR ? DISPLAYLCD_CURSOR : 0;
+			mode.flags |= op->data[0] & LCD_CONTROL_BLINK ? DISPLAYLCD_BLINK : 0;
+			mode.flags |= op->data[1] & LCD_ENTRY_INC ? 0 : DISPLAYLCD_RTL;
+		}
+		if(ioctl(fd, DISPLAYLCD_IOC_MODE, &mode) < 0)
+			ret = -errno;
+	}
+	else if(write(fd, op->data, op->len) < 0)
+		ret = -errno;
+
+	close(fd);
+	return ret;
+}
+
+static int cmp_ull(const void * a, const void * b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char ** argv)
+{
+	const char * base = "/dev/displaylcd";
+	double speed = 1;
+	int emulator = 0;
+	struct op * ops = NULL;
+	size_t count = 0;
+	size_t alloc = 0;
+	unsigned long long * latency;
+	unsigned long long start;
+	unsigned long long t;
+	unsigned long long total = 0;
+	char line[512];
+	FILE * f;
+	size_t x;
+	int errors = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "es:d:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'e': emulator = 1; break;
+			case 's': speed = atof(optarg); break;
+			case 'd': base = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-e] [-s speed] [-d device] tracefile\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(optind >= argc)
+	{
+		fprintf(stderr, "usage: %s [-e] [-s speed] [-d device] tracefile\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[optind], "r");
+	if(!f)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	while(fgets(line, sizeof(line), f))
+	{
+		if(count == alloc)
+		{
+			alloc = alloc ? 2 * alloc : 256;
+			ops = realloc(ops, alloc * sizeof(*ops));
+			if(!ops)
+				return 1;
+		}
+		if(parse_line(line, &ops[count]) == 0)
+			count++;
+	}
+	fclose(f);
+
+	if(count == 0)
+	{
+		fprintf(stderr, "%s: no operations in the trace\n", argv[optind]);
+		return 1;
+	}
+
+	latency = calloc(count, sizeof(*latency));
+	if(!latency)
+		return 1;
+
+	lcd_record_init(&rec);
+	lcd_core_init(&lcd, &lcd_record_bus, &rec);
+
+	start = now_ns();
+	for(x = 0; x < count; x++)
+	{
+		if(speed > 0)
+			sleep_until(start + (unsigned long long)((ops[x].ns - ops[0].ns) / speed));
+
+		t = now_ns();
+		if(emulator)
+			replay_emulator(&ops[x]);
+		else if(replay_device(base, &ops[x]) < 0)
+			errors++;
+		latency[x] = now_ns() - t;
+		total += latency[x];
+	}
+
+	qsort(latency, count, sizeof(*latency), cmp_ull);
+
+	printf("operations:   %zu\n", count);
+	printf("errors:       %d\n", errors);
+	printf("duration_ms:  %.3f (recorded %.3f)\n", (now_ns() - start) / 1e6, (ops[count - 1].ns - ops[0].ns) / 1e6);
+	printf("latency_us:   mean %.1f p50 %.1f p99 %.1f max %.1f\n", total / 1e3 / count,
+		latency[count / 2] / 1e3, latency[count * 99 / 100] / 1e3, latency[count - 1] / 1e3);
+	if(emulator)
+		printf("bus_ms:       %.3f (%lu commands, %lu characters)\n", rec.bus_ns / 1e6, rec.commands, rec.chars);
+	else
+		printf("bus_ms:       %.3f (the writes are synchronous, this is the total latency)\n", total / 1e6);
+
+	free(latency);
+	free(ops);
+	return errors ? 2 : 0;
+}
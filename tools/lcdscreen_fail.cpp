@@ -0,0 +1,48 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Layouts that displaylcd.hpp must refuse to compile. Without CASE the file compiles; make -C tools check compiles it once for every
+// case below and expects the error written after the case number.
+
+#include "displaylcd.hpp"
+
+using Lcd = displaylcd::Lcd16x2;
+using Temp = displaylcd::Field<Lcd, 1, 1, 8>;
+
+#if CASE == 1 // The display controller has memory for 80 characters only
+using Big = displaylcd::Geometry<4, 40>;
+static_assert(Big::cells);
+#elif CASE == 2 // The field row is outside the display
+static_assert(displaylcd::Field<Lcd, 3, 1, 4>::offset);
+#elif CASE == 3 // The field column is outside the display
+static_assert(displaylcd::Field<Lcd, 1, 17, 1>::offset);
+#elif CASE == 4 // The field does not fit in its row
+static_assert(displaylcd::Field<Lcd, 1, 14, 4>::offset);
+#elif CASE == 5 // Two fields of the screen overlap
+displaylcd::Screen<Lcd, Temp, displaylcd::Field<Lcd, 1, 5, 4>> screen;
+#elif CASE == 6 // Every field must belong to the screen geometry
+displaylcd::Screen<Lcd, displaylcd::Field<displaylcd::Geometry<4, 20>, 1, 1, 4>> screen;
+#elif CASE == 7 // The field is not part of this screen
+void f(displaylcd::Screen<Lcd, Temp> & screen) { screen.set<displaylcd::Field<Lcd, 2, 1, 4>>("x"); }
+#endif
+
+int main()
+{
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Tests of the C++ client (displaylcd.hpp) against its MockDevice, so no display is needed. The layouts that must not compile are
+// in lcdscreen_fail.cpp. Both are run by make -C tools check.
+
+#include <cstdio>
+#include <string_view>
+
+#include "displaylcd.hpp"
+
+using Lcd = displaylcd::Lcd16x2;
+using Temp = displaylcd::Field<Lcd, 1, 1, 8>;
+using Hum = displaylcd::Field<Lcd, 2, 1, 8>;
+using Clock = displaylcd::Field<Lcd, 1, 12, 5>;
+using Mock = displaylcd::MockDevice<Lcd>;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if(!(cond)) \
+		{ \
+			std::printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while(0)
+
+// The fields know where they are in the frame
+static void test_field()
+{
+	static_assert(Temp::offset == 0);
+	static_assert(Hum::offset == 16);
+	static_assert(Clock::offset == 11);
+	static_assert(displaylcd::detail::disjoint<Temp, Hum, Clock>::value);
+}
+
+// Nothing is sent until submit, and then the whole frame goes in one call
+static void test_submit()
+{
+	displaylcd::Screen<Lcd, Temp, Hum> screen;
+	Mock device;
+
+	screen.text(1, 10, "label");
+	screen.set<Temp>("abc");
+	CHECK(device.count() == 0);
+
+	CHECK(screen.submit(device) == 0);
+	CHECK(device.count() == 1);
+	CHECK(device.row(1) == "abc      label  ");
+	CHECK(device.row(2) == "                ");
+}
+
+// Strings and numbers are padded or truncated to the field width, and numbers that don't fit become '*'
+static void test_set()
+{
+	displaylcd::Screen<Lcd, Temp, Hum> screen;
+
+	screen.set<Temp>("a very long text");
+	CHECK(screen.row(1).substr(0, 8) == "a very l");
+	screen.set<Hum>(42);
+	CHECK(screen.row(2).substr(0, 8) == "      42");
+	screen.set<Hum>(-1234567);
+	CHECK(screen.row(2).substr(0, 8) == "-1234567");
+	screen.set<Hum>(123456789);
+	CHECK(screen.row(2).substr(0, 8) == "********");
+}
+
+// print formats into the field, without going past it
+static void test_print()
+{
+	displaylcd::Screen<Lcd, Temp, Clock> screen;
+
+	screen.print<Temp>("T %5.1fC", 23.5);
+	CHECK(screen.row(1).substr(0, 8) == "T  23.5C");
+	screen.print<Clock>("%02d:%02d:%02d", 12, 34, 56);
+	CHECK(screen.row(1).substr(11, 5) == "12:34");
+	CHECK(screen.row(1).substr(8, 3) == "   ");
+}
+
+// Text outside the display is ignored, and the text that doesn't fit in the row is cut
+static void test_text()
+{
+	displaylcd::Screen<Lcd, Temp> screen;
+
+	screen.text(3, 1, "nowhere");
+	screen.text(1, 17, "nowhere");
+	screen.text(2, 14, "cut here");
+	CHECK(screen.row(1) == "                ");
+	CHECK(screen.row(2) == "             cut");
+}
+
+// The errors of the device are returned by submit, and the frames sent before are kept
+static void test_errors()
+{
+	displaylcd::Screen<Lcd, Temp> screen;
+	Mock device;
+
+	screen.set<Temp>("one");
+	CHECK(screen.submit(device) == 0);
+	device.fail(EBUSY);
+	screen.set<Temp>("two");
+	CHECK(screen.submit(device) == EBUSY);
+	CHECK(device.count() == 1);
+	CHECK(device.row(1).substr(0, 3) == "one");
+	device.fail(0);
+	CHECK(screen.submit(device) == 0);
+	CHECK(device.count() == 2);
+	CHECK(device.frames()[1] == screen.frame());
+}
+
+int main()
+{
+	test_field();
+	test_submit();
+	test_set();
+	test_print();
+	test_text();
+	test_errors();
+
+	std::printf("%s\n", failures ? "FAIL" : "ok");
+	return failures ? 1 : 0;
+}
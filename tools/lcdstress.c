@@ -0,0 +1,496 @@
+/*
+ * 
+ *      Copyright (C) 2017 Christian Schultz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Stress test for concurrent writers. Many processes (and threads in each process) update the display at the same time, with
+// positioned row updates (a write to /dev/displaylcd_pos followed by a write to /dev/displaylcd), whole frame updates
+// (DISPLAYLCD_IOC_SHOW) and plain open/close. Each worker writes rows filled with its own letter, so the letter tags its updates.
+// Every update is checked as soon as it is written, while the worker still has the display (the emulator lock, or the device open
+// for writing): a frame must show the worker's letter in every row, and a row update must show it in the whole row. An update that
+// is not whole is counted as torn. A row update is two opens, so another worker can move the cursor in between and the row goes
+// somewhere else: on the emulator the address counter tells it apart (it is counted as moved, not torn), on the device it can not,
+// and a row that is not whole is counted as moved. In the end every row of the display must also have a single letter. The latency
+// of the operations is reported in percentiles, and the opens refused because another program had the display are counted.
+//
+// With -e the workers use the emulator (the driver core with the recording backend) instead of the device files. It is protected
+// by a lock and a single writer flag, like the driver, and the lock is held for the bus time the real display would take.
+// The emulator lives in the process memory, so -e uses threads only.
+//
+// Usage: lcdstress [-e] [-p processes] [-t threads] [-n operations] [-f percent] [-d device]
+//   -f percent  how many operations are whole frame updates (default 50), the rest are split between row updates and open/close
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "displaylcd.h"
+#include "displaylcd_core.h"
+#include "lcd_record.h"
+
+#define OP_ROW 0		// Positioned row update
+#define OP_FRAME 1		// Whole frame update
+#define OP_OPEN 2		// Open and close only
+#define OPS 3
+
+static const char * const op_names[] = { "row", "frame", "open" };
+
+struct result {
+	unsigned long long ns;	// Latency of the operation, including the retries when the display was busy
+	int op;
+};
+
+struct shared {
+	unsigned long busy;		// Opens refused with EBUSY
+	unsigned long errors;	// Other failures
+	unsigned long torn;		// Updates that were not whole right after they were written
+	unsigned long moved;	// Row updates written somewhere else, because another worker moved the cursor between the two opens
+};
+
+static const char * base = "/dev/displaylcd";
+static int emulator = 0;
+static int procs = 4;
+static int threads = 1;
+static int count = 1000;
+static int frame_percent = 50;
+static struct result * results;		// procs * threads * count results, shared between the processes
+static struct shared * shared;
+
+// The emulated driver
+static struct lcd_core lcd;
+static struct lcd_record rec;
+static pthread_mutex_t emu_lock = PTHREAD_MUTEX_INITIALIZER;
+static int emu_open = 0;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Waits the bus time of the last operation on the emulator, like the driver does while it holds its lock
+static void emu_bus_wait(unsigned long long bus_ns)
+{
+	unsigned long long end = now_ns() + bus_ns;
+
+	while(now_ns() < end)
+		;
+}
+
+static int read_display(char *);
+
+// Tells if the rows (all of them when row is negative) show only the letter
+static int rows_whole(const char * frame, char letter, int row)
+{
+	int first = row < 0 ? 0 : row * COLS;
+	int last = row < 0 ? CELLS : first + COLS;
+	int x;
+
+	for(x = first; x < last; x++)
+		if(frame[x] != letter)
+			return 0;
+	return 1;
+}
+
+// Checks an update right after it was written, with the display still held by the worker (on the emulator, the caller holds the
+// lock). moved tells that the row update did not start at its row; -1 when it is not known
+static void check_update(char letter, int row, int moved)
+{
+	char frame[CELLS];
+
+	if(read_display(frame))
+	{
+		__sync_fetch_and_add(&shared->errors, 1);
+		return;
+	}
+	if(rows_whole(frame, letter, row))
+		return;
+	if(row >= 0 && moved)
+		__sync_fetch_and_add(&shared->moved, 1);
+	else
+		__sync_fetch_and_add(&shared->torn, 1);
+}
+
+// Opens a device file, retrying while another writer has it. Returns a file descriptor, or (on the emulator) 0
+static int dev_open(const char * suffix)
+{
+	char path[256];
+	int fd;
+
+	for(;;)
+	{
+		if(emulator)
+		{
+			if(__sync_bool_compare_and_swap(&emu_open, 0, 1))
+				return 0;
+			errno = EBUSY;
+			fd = -1;
+		}
+		else
+		{
+			snprintf(path, sizeof(path), "%s%s", base, suffix);
+			fd = open(path, O_WRONLY);
+			if(fd >= 0)
+				return fd;
+		}
+
+		if(errno != EBUSY)
+			return -1;
+		__sync_fetch_and_add(&shared->busy, 1);
+		sched_yield();
+	}
+}
+
+static void dev_close(int fd)
+{
+	if(emulator)
+		__sync_lock_release(&emu_open);
+	else
+		close(fd);
+}
+
+// Sends a message to one of the device files (minor 0, 1 or 2). When letter is not 0, the row written (row) is checked with
+// check_update before the display is released
+static int dev_write(int fd, int minor, const char * data, size_t len, char letter, int row)
+{
+	unsigned long long bus;
+	int moved;
+
+	if(!emulator)
+	{
+		if(write(fd, data, len) < 0)
+			return -1;
+		if(letter)
+			check_update(letter, row, -1);
+		return 0;
+	}
+
+	pthread_mutex_lock(&emu_lock);
+	moved = rec.ac != lcd.offsets[row < 0 ? 0 : row];
+	bus = rec.bus_ns;
+	lcd_handle_write(&lcd, minor, data, len);
+	emu_bus_wait(rec.bus_ns - bus);
+	if(letter)
+		check_update(letter, row, moved);
+	pthread_mutex_unlock(&emu_lock);
+	return 0;
+}
+
+// Shows a whole frame, filled with letter, and checks it before the display is released
+static int dev_frame(int fd, const char * data, char letter)
+{
+	struct displaylcd_frame frame;
+	struct lcd_plan plan;
+	unsigned long long bus;
+
+	if(!emulator)
+	{
+		memset(frame.frame, ' ', sizeof(frame.frame));
+		memcpy(frame.frame, data, CELLS);
+		if(ioctl(fd, DISPLAYLCD_IOC_SHOW, &frame))
+			return -1;
+		check_update(letter, -1, 0);
+		return 0;
+	}
+
+	pthread_mutex_lock(&emu_lock);
+	bus = rec.bus_ns;
+	lcd_plan(&lcd, (const unsigned char *)data, &plan);
+	lcd_run(&lcd, &plan);
+	emu_bus_wait(rec.bus_ns - bus);
+	check_update(letter, -1, 0);
+	pthread_mutex_unlock(&emu_lock);
+	return 0;
+}
+
+// A positioned row update: the cursor is moved to the start of the row, and the row is written. Each is a separate open, like
+// a shell script using echo does, so another writer can get the display in between
+static int op_row(char letter, int row)
+{
+	char text[COLS];
+	char pos[4];
+	int fd;
+	int ret;
+
+	snprintf(pos, sizeof(pos), "%02d", row * COLS + 1);
+	memset(text, letter, COLS);
+
+	fd = dev_open("_pos");
+	if(fd < 0)
+		return -1;
+	ret = dev_write(fd, 2, pos, 2, 0, row);
+	dev_close(fd);
+	if(ret)
+		return ret;
+
+	fd = dev_open("");
+	if(fd < 0)
+		return -1;
+	ret = dev_write(fd, 0, text, COLS, letter, row);
+	dev_close(fd);
+	return ret;
+}
+
+static int op_frame(char letter)
+{
+	char frame[CELLS];
+	int fd;
+	int ret;
+
+	memset(frame, letter, CELLS);
+
+	fd = dev_open("");
+	if(fd < 0)
+		return -1;
+	ret = dev_frame(fd, frame, letter);
+	dev_close(fd);
+	return ret;
+}
+
+static int op_open(void)
+{
+	int fd = dev_open("");
+
+	if(fd < 0)
+		return -1;
+	dev_close(fd);
+	return 0;
+}
+
+struct worker {
+	int id;					// Global worker number, the letter written is 'A' + id % 26
+	unsigned int seed;
+};
+
+static void * worker_run(void * arg)
+{
+	struct worker * w = arg;
+	struct result * r = &results[(size_t)w->id * count];
+	unsigned long long t;
+	char letter = 'A' + w->id % 26;
+	int choice;
+	int ret;
+	int x;
+
+	for(x = 0; x < count; x++)
+	{
+		choice = rand_r(&w->seed) % 100;
+		if(choice < frame_percent)
+			r[x].op = OP_FRAME;
+		else if(choice < frame_percent + (100 - frame_percent) * 3 / 4)
+			r[x].op = OP_ROW;
+		else
+			r[x].op = OP_OPEN;
+
+		t = now_ns();
+		if(r[x].op == OP_FRAME)
+			ret = op_frame(letter);
+		else if(r[x].op == OP_ROW)
+			ret = op_row(letter, rand_r(&w->seed) % ROWS);
+		else
+			ret = op_open();
+		r[x].ns = now_ns() - t;
+
+		if(ret)
+			__sync_fetch_and_add(&shared->errors, 1);
+	}
+
+	return NULL;
+}
+
+static void run_process(int p)
+{
+	pthread_t tid[threads];
+	struct worker w[threads];
+	int x;
+
+	for(x = 0; x < threads; x++)
+	{
+		w[x].id = p * threads + x;
+		w[x].seed = w[x].id + 1;
+		pthread_create(&tid[x], NULL, worker_run, &w[x]);
+	}
+	for(x = 0; x < threads; x++)
+		pthread_join(tid[x], NULL);
+}
+
+// Reads the display content, from the driver (the first line is the generation, then the rows) or from the emulator
+static int read_display(char * frame)
+{
+	char text[256];
+	char * p;
+	int fd;
+	int n;
+	int x;
+
+	if(emulator)
+	{
+		lcd_record_frame(&rec, &lcd, (unsigned char *)frame);
+		return 0;
+	}
+
+	fd = open(base, O_RDONLY);
+	if(fd < 0)
+		return -1;
+	n = read(fd, text, sizeof(text) - 1);
+	close(fd);
+	if(n <= 0)
+		return -1;
+	text[n] = 0;
+
+	p = strchr(text, '\n');
+	for(x = 0; x < ROWS; x++)
+	{
+		if(!p || strlen(p + 1) < COLS)
+			return -1;
+		memcpy(&frame[x * COLS], p + 1, COLS);
+		p = strchr(p + 1, '\n');
+	}
+	return 0;
+}
+
+static int cmp_ull(const void * a, const void * b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char ** argv)
+{
+	size_t total;
+	unsigned long long * lat;
+	unsigned long long start;
+	unsigned long long elapsed;
+	char frame[CELLS];
+	size_t n;
+	size_t x;
+	int corrupted = 0;
+	int opt;
+	int op;
+	int p;
+	int y;
+
+	while((opt = getopt(argc, argv, "ep:t:n:f:d:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'e': emulator = 1; break;
+			case 'p': procs = atoi(optarg); break;
+			case 't': threads = atoi(optarg); break;
+			case 'n': count = atoi(optarg); break;
+			case 'f': frame_percent = atoi(optarg); break;
+			case 'd': base = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-e] [-p processes] [-t threads] [-n operations] [-f percent] [-d device]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(emulator)	// The emulator is in this process memory, the workers must be threads
+	{
+		threads *= procs;
+		procs = 1;
+	}
+
+	if(procs < 1 || threads < 1 || count < 1 || frame_percent < 0 || frame_percent > 100)
+	{
+		fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+		return 1;
+	}
+
+	total = (size_t)procs * threads * count;
+	results = mmap(NULL, total * sizeof(*results) + sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(results == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+	shared = (struct shared *)&results[total];
+
+	lcd_record_init(&rec);
+	lcd_core_init(&lcd, &lcd_record_bus, &rec);
+
+	start = now_ns();
+	for(p = 0; p < procs; p++)
+	{
+		if(procs == 1)
+			run_process(0);
+		else if(fork() == 0)
+		{
+			run_process(p);
+			_exit(0);
+		}
+	}
+	while(wait(NULL) > 0)
+		;
+	elapsed = now_ns() - start;
+
+	printf("workers:    %d processes x %d threads, %d operations each, %.3f s\n", procs, threads, count, elapsed / 1e9);
+	printf("busy:       %lu opens refused (EBUSY)\n", shared->busy);
+	printf("errors:     %lu\n", shared->errors);
+	printf("torn:       %lu updates not whole right after they were written\n", shared->torn);
+	printf("moved:      %lu row updates moved by another writer\n", shared->moved);
+
+	lat = malloc(total * sizeof(*lat));
+	if(!lat)
+		return 1;
+
+	for(op = 0; op < OPS; op++)
+	{
+		for(n = 0, x = 0; x < total; x++)
+			if(results[x].op == op)
+				lat[n++] = results[x].ns;
+		if(n == 0)
+			continue;
+
+		qsort(lat, n, sizeof(*lat), cmp_ull);
+		printf("%-6s us:  n %zu p50 %.1f p90 %.1f p99 %.1f max %.1f\n", op_names[op], n,
+			lat[n / 2] / 1e3, lat[n * 90 / 100] / 1e3, lat[n * 99 / 100] / 1e3, lat[n - 1] / 1e3);
+	}
+	free(lat);
+
+	// Every row must have been written by a single worker
+	if(read_display(frame))
+	{
+		fprintf(stderr, "%s: unable to read the display content\n", argv[0]);
+		return 1;
+	}
+	for(x = 0; x < ROWS; x++)
+	{
+		for(y = 1; y < COLS; y++)
+			if(frame[x * COLS + y] != frame[x * COLS])
+				break;
+		printf("row %zu:      |%.*s|%s\n", x + 1, COLS, &frame[x * COLS], y < COLS ? " interleaved" : "");
+		if(y < COLS)
+			corrupted++;
+	}
+
+	return corrupted || shared->torn || shared->errors ? 2 : 0;
+}